@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "carehttp.h"
+
+// measures request parsing and handler throughput through the memory transport (no sockets or kernel involved)
+// and checks that requests split up at every possible position are handled the same way as unsplit ones.
+
+#define REQUESTS 200000
+#define PIPELINED 64
+
+static const char request[]="GET /hello/bob/3?extra=some%20value&x=1 HTTP/1.1\r\nHost: localhost\r\nUser-Agent: carehttp-bench\r\nAccept: */*\r\n\r\n";
+
+static const char wsrequest[]="GET /socket HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+// a masked ping frame with a 4 byte payload (the mask is all zeroes)
+static const char wsping[]={ (char)0x89,(char)0x84,0,0,0,0,'p','i','n','g' };
+
+static char out[1<<20];
+
+// the handler that is measured
+static void handle(void *req) {
+	char name[100],extra[50];
+	int a;
+	if (carehttp_match(req,"/hello/%100s/%d",name,&a)) {
+		carehttp_printf(req,"Hello %s %d\n",name,a);
+		if (0<=carehttp_get_param(req,extra,sizeof(extra),"extra"))
+			carehttp_printf(req,"extra '%s'\n",extra);
+	} else {
+		carehttp_responsecode(req,404);
+		carehttp_printf(req,"Resource not found");
+	}
+	carehttp_finish(req);
+}
+
+// polls until nothing more happens, returns the number of handled requests and collects the output
+static int drive(void *listener,void *client,int *outlen) {
+	int handled=0,idle=0;
+	while(idle<3) {
+		void *req=carehttp_poll_listener(listener);
+		int rc=carehttp_memory_collect(client,out+*outlen,sizeof(out)-*outlen);
+		if (!carehttp_memory_unread(client))
+			idle++;
+		if (req) {
+			handle(req);
+			handled++;
+			idle=0;
+		}
+		if (rc>0) {
+			*outlen+=rc;
+			idle=0;
+		}
+	}
+	return handled;
+}
+
+// removes the date headers since they can differ between responses
+static int strip_date(char *buf,int len) {
+	char *p;
+	buf[len]=0;
+	while((p=strstr(buf,"\r\nDate: "))) {
+		char *e=strstr(p+2,"\r\n");
+		memmove(p,e,strlen(e)+1);
+	}
+	return strlen(buf);
+}
+
+static void bench(const char *name,void *listener,int count,int batch) {
+	void *client=carehttp_memory_connect(listener);
+	clock_t start=clock();
+	double secs;
+	int i,j,outlen;
+	for (i=0;i<count;i+=batch) {
+		for (j=0;j<batch;j++)
+			carehttp_memory_feed(client,request,sizeof(request)-1);
+		outlen=0;
+		if (drive(listener,client,&outlen)!=batch) {
+			printf("%s: requests got lost\n",name);
+			break;
+		}
+	}
+	secs=(double)(clock()-start)/CLOCKS_PER_SEC;
+	printf("%-32s %8.0f requests/s\n",name,count/(secs>0?secs:1e-9));
+	carehttp_memory_close(client);
+}
+
+// feeds data in two pieces split at every position and compares the responses with the unsplit one
+static int splits(void *listener,const char *data,int len,int expect) {
+	static char reference[1<<16];
+	int reflen=0,outlen,i,failed=0;
+	void *client=carehttp_memory_connect(listener);
+
+	carehttp_memory_feed(client,data,len);
+	if (drive(listener,client,&reflen)!=expect) {
+		printf("unsplit input wasn't handled\n");
+		return 1;
+	}
+	reflen=strip_date(out,reflen);
+	memcpy(reference,out,reflen+1);
+
+	for (i=1;i<len;i++) {
+		outlen=0;
+		carehttp_memory_feed(client,data,i);
+		if (drive(listener,client,&outlen)!=0 && i<len/expect) {
+			printf("request handled before being complete (split at %d)\n",i);
+			failed++;
+		}
+		carehttp_memory_feed(client,data+i,len-i);
+		drive(listener,client,&outlen);
+		outlen=strip_date(out,outlen);
+		if (outlen!=reflen || memcmp(out,reference,reflen)) {
+			printf("response differs when split at %d\n",i);
+			failed++;
+		}
+	}
+	carehttp_memory_close(client);
+	return failed;
+}
+
+// a transport with a client that keeps sending but stops reading once it has received STALL_AFTER bytes,
+// the server has to stop reading as well instead of buffering up everything the client sends.
+#define STALL_AFTER (200*1024)
+#define STALL_POLLS 20000
+
+struct stalled {
+	const char *first,*repeat; // sent once and then over and over again
+	int firstlen,replen,pos,accepted;
+	long received,sent;
+};
+
+static int stalled_accept(void *ctx,void **connctx) {
+	struct stalled *st=(struct stalled*)ctx;
+	if (st->accepted)
+		return 0;
+	st->accepted=1;
+	*connctx=st;
+	return 1;
+}
+
+static int stalled_recv(void *ctx,char *buf,int size) {
+	struct stalled *st=(struct stalled*)ctx;
+	int count=0;
+	while(count<size) {
+		const char *data=st->pos<st->firstlen?st->first+st->pos:st->repeat+(st->pos-st->firstlen)%st->replen;
+		int left=st->pos<st->firstlen?st->firstlen-st->pos:st->replen-(st->pos-st->firstlen)%st->replen;
+		if (left>size-count)
+			left=size-count;
+		memcpy(buf+count,data,left);
+		count+=left;
+		st->pos+=left;
+	}
+	st->received+=count;
+	return count;
+}
+
+static int stalled_send(void *ctx,const char *buf,int size) {
+	struct stalled *st=(struct stalled*)ctx;
+	if (st->sent>=STALL_AFTER)
+		return CAREHTTP_WOULDBLOCK;
+	st->sent+=size;
+	return size;
+}
+
+static void stalled_close(void *ctx) {
+}
+
+static const struct carehttp_transport stalled_transport={ stalled_accept,stalled_recv,stalled_send,stalled_close };
+
+// polls a stalled client for a while and checks how much the server has read from it
+// (the client MUST outlive the call since listeners are never closed)
+static int stalled(const char *name,struct stalled *st,const char *first,const char *repeat,int replen) {
+	void *listener;
+	int i;
+	memset(st,0,sizeof(*st));
+	st->first=first;
+	st->firstlen=strlen(first);
+	st->repeat=repeat;
+	st->replen=replen;
+	listener=carehttp_listen_transport(&stalled_transport,st);
+	for (i=0;i<STALL_POLLS;i++) {
+		void *req=carehttp_poll_listener(listener);
+		if (!req)
+			continue;
+		if (carehttp_ws_message(req,0,0))
+			continue; // nothing is sent as messages
+		if (carehttp_match(req,"/socket"))
+			carehttp_ws_upgrade(req);
+		else
+			handle(req);
+	}
+	// the server may hold a highwater of output and a read of input, far less than this
+	printf("%-32s read %ld bytes\n",name,st->received);
+	return st->received>4*STALL_AFTER;
+}
+
+int main(int argc,char **argv) {
+	static struct stalled pipelining,pinging;
+	char pipelined[sizeof(request)*2];
+	void *whole=carehttp_listen_memory(0);
+	int failed=0,chunk;
+
+	// make sure that splitting up the input doesn't change anything
+	failed+=splits(whole,request,sizeof(request)-1,1);
+	memcpy(pipelined,request,sizeof(request)-1);
+	memcpy(pipelined+sizeof(request)-1,request,sizeof(request)-1);
+	failed+=splits(whole,pipelined,2*(sizeof(request)-1),2);
+	for (chunk=1;chunk<=8;chunk++)
+		failed+=splits(carehttp_listen_memory(chunk),request,sizeof(request)-1,1);
+	printf("split checks %s\n",failed?"FAILED":"passed");
+
+	// clients that don't read mustn't make the server buffer up everything they send
+	failed+=stalled("stalled pipelining client",&pipelining,"",request,sizeof(request)-1);
+	failed+=stalled("stalled websocket pinging client",&pinging,wsrequest,wsping,sizeof(wsping));
+
+	bench("keep-alive",whole,REQUESTS,1);
+	bench("pipelined",whole,REQUESTS,PIPELINED);
+	bench("keep-alive, 16 byte reads",carehttp_listen_memory(16),REQUESTS/4,1);
+	bench("keep-alive, 1 byte reads",carehttp_listen_memory(1),REQUESTS/40,1);
+
+	return failed?1:0;
+}
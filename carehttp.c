@@ -4,6 +4,10 @@
 //#define VERBOSE
 #define VERBOSELEVEL 2
 
+// uncomment this line to use io_uring on linux, regular polling is still used
+// if the running kernel doesn't support the needed io_uring features.
+//#define CAREHTTP_URING
+
 // Some defines to detect win32 compilation if it isn't specified already!
 #ifndef WIN32
  #ifdef _MSC_VER
@@ -39,9 +43,27 @@ static int wsIsInit=0;
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <stddef.h>
 
 // win32 has these separated so we have an ifdef to emulate it
 #define closesocket(x) close(x)
+
+#ifdef CAREHTTP_URING
+ #ifdef __linux__
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <linux/io_uring.h>
+ #else
+  #undef CAREHTTP_URING
+ #endif
+#endif
+#endif
+
+// a peer that closes early shouldn't kill the process with SIGPIPE (the flag is missing on some platforms)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
 #endif
 
 #include <stdarg.h>
@@ -49,6 +71,7 @@ static int wsIsInit=0;
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 
 #include "carehttp.h"
 
@@ -93,14 +116,21 @@ struct carehttp_connection {
 	// don't deallocate it until it has been made invisible.
 	int visible;
 
+	// listener sockets are identified by a tcp port number or a unix domain socket path (null for tcp listeners)
+	int port;
+	char *path;
+
+	// listeners with a transport (and the connections accepted from them) move their data through it instead of a socket.
+	const struct carehttp_transport *transport;
+	void *ctx;
+
 	// input state can have a bunch of different values.
-	// * for listener sockets it doubles as a port number 
-	// 
-	// regular states:
 	// * negative values indicates an error and tells the system to clean up and not perform more operations.
 	// * 0 means that we're still reading the header.
 	// * 1 means that we've finished the initial headers and are producing data
-	// * (todo) 2+ means that we are expecting post data either directly or via chunked encodings.
+	// * 2 means that the connection has been upgraded to a websocket
+	// * 3 means that the connection is subscribed to an event stream channel
+	// * (todo) 4+ means that we are expecting post data either directly or via chunked encodings.
 
 	int instate;
 	struct carehttp_buf inbuf;
@@ -111,6 +141,7 @@ struct carehttp_connection {
 		int param_index; // index of URI parameter parts
 		int version_index; // version
 		int headers_index; // where to begin searching the headers.
+		int status; // response code once the status line has been written
 	}headinfo;
 
 	// output state and buffers (we have a circular array of buffers)
@@ -121,7 +152,98 @@ struct carehttp_connection {
 	int roffset;  // the offset inside that buffer
 	int woutidx;  // the user facing output buffer index
 	struct carehttp_buf outbufs[OUTBUFS];
+
+	// backpressure state, a highwater of 0 means that the body is buffered in full until finish is called.
+	// otherwise the body is streamed out with chunked encoding and writes are refused while too much is unsent.
+	int highwater; // max number of bytes in the body buffer before a flush is needed.
+	int streaming; // set once the headers have been flushed, 1 when the body is sent as chunks and 2 when it ends by closing (http/1.0).
+	int finishing; // set by finish when the final chunk is waiting for a free buffer pair.
+	int wantwrite; // set when a write was refused, the user is notified via poll once output has drained.
+	int resumed;   // set when poll returned this connection due to a writable notification.
+	int closing;   // close the connection once all output has been sent.
+	int peerclosed; // the other end won't send any more data.
+	int served;    // set once a response has been committed, fresh connections aren't idle while draining.
+
+	// websocket state, messages are assembled into wsmsg and handed to the user by poll.
+	int websocket; // 1 when upgraded, 2 once the close has been reported to the user.
+	int wsop;      // opcode of the message being assembled (0 when none)
+	int wsready;   // opcode of a complete message in wsmsg to report to the user (0 when none)
+	struct carehttp_buf wsmsg;
+
+	// event stream state, published events are shared between subscribers and queued up by reference.
+	struct carehttp_channel *channel;
+	struct carehttp_connection *chnext; // next subscriber of the same channel
+	struct carehttp_event **evqueue; // a circular queue of events to send
+	int evcap;    // size of the queue
+	int evfirst;  // index of the first queued event
+	int evcount;  // number of queued events
+	int evoffset; // how much of the first event that has been sent
+
+#ifdef CAREHTTP_URING
+	// io_uring state, the connection can't be freed while the kernel has operations in flight.
+	int uring_ops;   // number of operations in flight
+	int uring_recv;  // 1 while a recv (or accept for listeners) is armed, 2 while it's being cancelled
+	int uring_send;  // set while a send is in flight
+	int uring_error; // set when an operation has failed
+	// sends gather all pending output buffers and events into one message
+#define URING_IOVS 16
+	struct iovec uring_iov[URING_IOVS];
+	struct msghdr uring_msg;
+	int uring_ringbytes; // how much of the message that comes from the output buffers (the rest are events)
+	int uring_events;    // the number of events in the message
+#endif
+};
+
+// an encoded event, the data is shared by all subscribers it was published to.
+struct carehttp_event {
+	int refs;
+	int length;
+	char data[1];
+};
+
+// event stream channels are identified by name and live as long as they have subscribers.
+struct carehttp_channel {
+	struct carehttp_channel *next;
+	char *name;
+	struct carehttp_connection *subscribers;
 };
+static struct carehttp_channel *channels=0;
+
+// how many events a subscriber can have queued up and what to do with slow subscribers
+static int sse_maxqueued=64;
+static int sse_policy=CAREHTTP_SSE_DISCONNECT;
+
+static void carehttp_event_release(struct carehttp_event *ev) {
+	if (!--ev->refs)
+		free(ev);
+}
+
+// removes a connection from the subscribers of its channel and frees the channel once nobody is left
+static void carehttp_sse_unsubscribe(struct carehttp_connection *cur) {
+	struct carehttp_channel *ch=cur->channel,**pch;
+	struct carehttp_connection **psub;
+	if (!ch)
+		return;
+	for (psub=&ch->subscribers;*psub!=cur;psub=&(*psub)->chnext)
+		;
+	*psub=cur->chnext;
+	cur->chnext=0;
+	cur->channel=0;
+	if (ch->subscribers)
+		return;
+	for (pch=&channels;*pch!=ch;pch=&(*pch)->next)
+		;
+	*pch=ch->next;
+	free(ch->name);
+	free(ch);
+}
+
+// input is neither read nor parsed while more than this amount of data is unsent on a connection
+// (connections with a highwater set use that value instead)
+#define CAREHTTP_INPUT_HIGHWATER (1<<16)
+
+// highwater value given to new connections
+static int default_highwater=0;
 
 // a 64k tmp buffer for the recv command (data is then copied to indivdual connection buffers for parsing)
 static char tmpbuf[1<<16];
@@ -133,7 +255,10 @@ static struct carehttp_connection *connections=0;
 static int carehttp_buf_reserve(struct carehttp_buf *line,int sz) {
 	if (line->cap<sz) {
 		void *old=line->data;
-		int newsize=sz+200; // 200 is a random addition in case we get a small trailing read afterwards
+		// grow geometrically so that many small appends to a large buffer don't realloc every time
+		int newsize=line->cap<128?256:line->cap*2;
+		if (newsize<sz || newsize<0)
+			newsize=sz;
 		line->data=realloc(line->data,newsize+1);
 		if (!line->data) {
 			// some kind of out-of-memory condition, dispose of data and return an error.
@@ -147,6 +272,573 @@ static int carehttp_buf_reserve(struct carehttp_buf *line,int sz) {
 	return 0;
 }
 
+// appends a number of bytes with a known length to a buffer (keeping it null terminated)
+// returns -1 if we're out of memory
+static int carehttp_buf_append(struct carehttp_buf *buf,const char *data,int count) {
+	if (carehttp_buf_reserve(buf,buf->length+count+1))
+		return -1;
+	memcpy(buf->data+buf->length,data,count);
+	buf->length+=count;
+	buf->data[buf->length]=0;
+	return 0;
+}
+
+// writes the decimal representation of a non-negative number at the end of
+// the supplied space and returns a pointer to the first digit (no sprintf parsing needed)
+static char* carehttp_utoa(char *end,unsigned int v) {
+	*--end=0;
+	do {
+		*--end='0'+(v%10);
+		v/=10;
+	} while(v);
+	return end;
+}
+
+// the number of bytes queued up for sending that has not yet been sent
+static int carehttp_pending(struct carehttp_connection *cur) {
+	int i,total=-cur->roffset;
+	for (i=cur->routidx;i!=cur->woutidx;i=(i+1)%OUTBUFS)
+		total+=cur->outbufs[i].length;
+	return total;
+}
+
+// is there too much output waiting to be sent to take in more input? (this includes output still being
+// written such as answers to websocket pings)
+static int carehttp_output_full(struct carehttp_connection *cur) {
+	return carehttp_pending(cur)+cur->outbufs[cur->woutidx+1].length>=(cur->highwater>0?cur->highwater:CAREHTTP_INPUT_HIGHWATER);
+}
+
+// is there a complete request waiting after the one being handled? (there's no point in reading more then)
+static int carehttp_request_buffered(struct carehttp_connection *cur) {
+	int i;
+	if (cur->instate!=0 && cur->instate!=1)
+		return 0;
+	for (i=cur->headinfo.headsize;i<cur->inbuf.length-3;i++) {
+		if (!memcmp(cur->inbuf.data+i,"\r\n\r\n",4))
+			return 1;
+	}
+	return 0;
+}
+
+// can the current output buffer pair be queued up for sending without
+// the next pair overlapping with buffers that are still being transmitted?
+static int carehttp_can_commit(struct carehttp_connection *cur) {
+	return ((cur->woutidx+2)%OUTBUFS)!=cur->routidx && ((cur->woutidx+3)%OUTBUFS)!=cur->routidx;
+}
+
+static int carehttp_flush_body(struct carehttp_connection *cur);
+static int carehttp_ws_frame(struct carehttp_connection *cur,int opcode,const char *data,int count);
+static void carehttp_commit_response(struct carehttp_connection *cur);
+static int carehttp_ws_parse(struct carehttp_connection *cur);
+
+// creates a connection for a newly accepted socket and links it in at the specified place in the connection list
+static struct carehttp_connection* carehttp_new_connection(struct carehttp_connection **link,struct carehttp_connection *listener,int sock,void *ctx) {
+	// a new socket was opened, allocate an associated connection
+	struct carehttp_connection *newconn=(struct carehttp_connection*)calloc(1,sizeof(struct carehttp_connection));
+#ifdef VERBOSE
+	fprintf(stderr,"Got a new connection %p:%d\n",newconn,sock);
+#endif
+	if (!newconn) {
+		// not enough memory, close it and continue processing.
+		if (listener->transport)
+			listener->transport->close(ctx);
+		else
+			closesocket(sock);
+		return 0;
+	}
+	newconn->parent=listener; // set the parent port
+	newconn->handle=sock;     // set the socket
+	newconn->transport=listener->transport;
+	newconn->ctx=ctx;
+	newconn->highwater=default_highwater;
+	if (!listener->transport)
+		carehttp_socket_set_nonblocking(sock); // and make it non-blocking
+	newconn->next=*link;
+	*link=newconn;
+	return newconn;
+}
+
+// adds received data to the input buffer
+static int carehttp_received(struct carehttp_connection *cur,const char *data,int count) {
+	if (carehttp_buf_reserve(&cur->inbuf,cur->inbuf.length+count+1)) {
+		// error allocating memory, clean up the connection
+		return -1;
+	}
+	memcpy(cur->inbuf.data+cur->inbuf.length,data,count); // add new data
+	cur->inbuf.length+=count; // update length
+	cur->inbuf.data[cur->inbuf.length]=0; // null terminate the buffer
+	return 0;
+}
+
+// sends data through the socket or transport, returns the number of bytes sent, CAREHTTP_WOULDBLOCK or -1 on errors
+static int carehttp_send(struct carehttp_connection *cur,const char *data,int count) {
+	int wr;
+	if (cur->transport)
+		return cur->transport->send(cur->ctx,data,count);
+	wr=send(cur->handle,data,count,MSG_NOSIGNAL);
+	if (wr<0 && carehttp_socket_wasblock(cur->handle))
+		return CAREHTTP_WOULDBLOCK;
+	return wr;
+}
+
+// sends as much pending output as the socket accepts,
+// returns -1 on errors or 1 if something was sent
+static int carehttp_send_pending(struct carehttp_connection *cur) {
+	int work=0;
+	// while we have buffers pending to be sent to the network queue them up for sending.
+	while(cur->routidx!=cur->woutidx) {
+		int wr;
+		// take the first buffer
+		struct carehttp_buf *buf=cur->outbufs+cur->routidx;
+		
+		// is this buffer empty or did we finish sending?
+		if (cur->roffset>=buf->length) {
+			// if so, advance to the next buffer
+			cur->routidx=(cur->routidx+1)%OUTBUFS;
+			// begin from the start of that one.
+			cur->roffset=0;
+			// and clear this output buffer for the next round of data.
+			buf->length=0;
+			// go to the next output buffer
+			continue;
+		}
+		
+		// try to send the remainder in one go if possible.
+		wr=carehttp_send(cur,buf->data+cur->roffset,buf->length-cur->roffset);
+		if (wr<0) {
+			// blocking or some kind of error
+			if (wr!=CAREHTTP_WOULDBLOCK)
+				return -1; // not blocking so an real error
+			break; // otherwise try again later
+		} else {
+			work|=wr>0;
+			// consume the sent amount of bytes
+			cur->roffset+=wr;
+			// finished sending?
+			if (cur->roffset==buf->length) {
+				continue;
+			} else {
+				// could not send all pending data in the buffer so let's try again later.
+				break;
+			}
+		}
+	}
+	// event streams send their queued events once the regular output has been sent
+	while(cur->evcount && cur->routidx==cur->woutidx) {
+		struct carehttp_event *ev=cur->evqueue[cur->evfirst];
+		int wr=carehttp_send(cur,ev->data+cur->evoffset,ev->length-cur->evoffset);
+		if (wr<0) {
+			if (wr!=CAREHTTP_WOULDBLOCK)
+				return -1;
+			break;
+		}
+		work|=wr>0;
+		cur->evoffset+=wr;
+		if (cur->evoffset<ev->length)
+			break;
+		// the event was sent in full so let go of it
+		carehttp_event_release(ev);
+		cur->evfirst=(cur->evfirst+1)%cur->evcap;
+		cur->evcount--;
+		cur->evoffset=0;
+	}
+	return work;
+}
+
+// reads in some data, returns -1 on errors or 1 if something happened
+static int carehttp_receive(struct carehttp_connection *cur) {
+	int rc;
+	if (cur->peerclosed)
+		return 0;
+	if (cur->transport) {
+		rc=cur->transport->recv(cur->ctx,tmpbuf,sizeof(tmpbuf));
+		if (rc==CAREHTTP_WOULDBLOCK)
+			return 0;
+	} else {
+		rc=recv(cur->handle,tmpbuf,sizeof(tmpbuf),0);
+		if (rc<0 && carehttp_socket_wasblock(cur->handle))
+			return 0;
+	}
+	if (rc<0) {
+		return -1; // A real error so we need to close and clean up
+	} else if (rc==0) {
+		// the other end has closed
+		cur->peerclosed=1;
+		return 1;
+	}
+	if (carehttp_received(cur,tmpbuf,rc))
+		return -1;
+	return 1;
+}
+
+#ifdef CAREHTTP_URING
+// the io_uring backend keeps accepts and recvs armed as multishot operations that produce completions on their own,
+// received data lands in a ring of provided buffers and is copied to the connection input buffers as completions are reaped.
+// sends are queued up for all connections during a poll and submitted together with a single io_uring_enter call.
+#define URING_ENTRIES 256
+#define URING_BUFS    64 // number of provided recv buffers (MUST be a power of 2)
+#define URING_BUFSIZE (1<<14)
+
+// operations are tagged in the low bits of the connection pointer in the user data
+#define URING_ACCEPT 1
+#define URING_RECV   2
+#define URING_SEND   3
+
+static struct {
+	int fd;
+	int active;
+	int single_recv; // set if the kernel lacks multishot recv support
+
+	unsigned *sq_head,*sq_tail,*sq_mask,*sq_array;
+	unsigned sq_entries;
+	unsigned sqtail;  // our local tail that is published on submit
+	unsigned queued;  // entries not submitted yet
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head,*cq_tail,*cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct io_uring_buf_ring *br;
+	unsigned brtail;
+	char *bufs;
+
+	void *ringmem;
+	size_t ringsize;
+	size_t sqesize;
+} uring={-1};
+
+// submits queued entries and waits up to timeout ms for a completion (if timeout isn't 0)
+static void carehttp_uring_enter(int timeout) {
+	int rc;
+	if (!timeout && !uring.queued)
+		return; // nothing to submit or wait for so the syscall can be skipped
+	__atomic_store_n(uring.sq_tail,uring.sqtail,__ATOMIC_RELEASE);
+	if (timeout) {
+		struct __kernel_timespec ts;
+		struct io_uring_getevents_arg arg;
+		memset(&arg,0,sizeof(arg));
+		ts.tv_sec=0;
+		ts.tv_nsec=timeout*1000000LL;
+		arg.ts=(__u64)(unsigned long)&ts;
+		rc=syscall(__NR_io_uring_enter,uring.fd,uring.queued,1,IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,&arg,sizeof(arg));
+	} else {
+		rc=syscall(__NR_io_uring_enter,uring.fd,uring.queued,0,0,NULL,0);
+	}
+	if (rc>0)
+		uring.queued-=rc<(int)uring.queued?rc:uring.queued;
+}
+
+// grabs a cleared submission entry, submitting queued ones first if the ring is full.
+static struct io_uring_sqe* carehttp_uring_sqe(int op,int fd,unsigned long ptr,int tag) {
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+	if (uring.sqtail-__atomic_load_n(uring.sq_head,__ATOMIC_ACQUIRE)>=uring.sq_entries) {
+		carehttp_uring_enter(0);
+		if (uring.sqtail-__atomic_load_n(uring.sq_head,__ATOMIC_ACQUIRE)>=uring.sq_entries)
+			return 0;
+	}
+	idx=uring.sqtail&*uring.sq_mask;
+	sqe=uring.sqes+idx;
+	memset(sqe,0,sizeof(*sqe));
+	sqe->opcode=op;
+	sqe->fd=fd;
+	sqe->user_data=ptr|tag;
+	uring.sq_array[idx]=idx;
+	uring.sqtail++;
+	uring.queued++;
+	return sqe;
+}
+
+// hands a provided buffer back to the kernel (published when reaping finishes)
+static void carehttp_uring_recycle(int bid) {
+	struct io_uring_buf *b=uring.br->bufs+(uring.brtail&(URING_BUFS-1));
+	b->addr=(__u64)(unsigned long)(uring.bufs+bid*URING_BUFSIZE);
+	b->len=URING_BUFSIZE;
+	b->bid=bid;
+	uring.brtail++;
+}
+
+static void carehttp_uring_shutdown() {
+	if (uring.bufs)
+		free(uring.bufs);
+	if (uring.br)
+		munmap(uring.br,URING_BUFS*sizeof(struct io_uring_buf));
+	if (uring.sqes)
+		munmap(uring.sqes,uring.sqesize);
+	if (uring.ringmem)
+		munmap(uring.ringmem,uring.ringsize);
+	if (uring.fd!=-1)
+		close(uring.fd);
+	memset(&uring,0,sizeof(uring));
+	uring.fd=-1;
+}
+
+static void carehttp_uring_init() {
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	char *ring;
+	size_t cqsize;
+	int i;
+
+	memset(&p,0,sizeof(p));
+	if (0>(uring.fd=syscall(__NR_io_uring_setup,URING_ENTRIES,&p))) {
+		uring.fd=-1;
+		return; // no io_uring support at all (or it's disabled)
+	}
+	// we depend on features that came with newer kernels, missing features means regular polling.
+	if ((p.features&(IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG))!=(IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG))
+		goto fail;
+
+	uring.ringsize=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	cqsize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	if (cqsize>uring.ringsize)
+		uring.ringsize=cqsize;
+	ring=mmap(0,uring.ringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,uring.fd,IORING_OFF_SQ_RING);
+	if (ring==MAP_FAILED)
+		goto fail;
+	uring.ringmem=ring;
+	uring.sqesize=p.sq_entries*sizeof(struct io_uring_sqe);
+	uring.sqes=mmap(0,uring.sqesize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,uring.fd,IORING_OFF_SQES);
+	if (uring.sqes==MAP_FAILED) {
+		uring.sqes=0;
+		goto fail;
+	}
+	uring.sq_head=(unsigned*)(ring+p.sq_off.head);
+	uring.sq_tail=(unsigned*)(ring+p.sq_off.tail);
+	uring.sq_mask=(unsigned*)(ring+p.sq_off.ring_mask);
+	uring.sq_array=(unsigned*)(ring+p.sq_off.array);
+	uring.sq_entries=p.sq_entries;
+	uring.sqtail=*uring.sq_tail;
+	uring.cq_head=(unsigned*)(ring+p.cq_off.head);
+	uring.cq_tail=(unsigned*)(ring+p.cq_off.tail);
+	uring.cq_mask=(unsigned*)(ring+p.cq_off.ring_mask);
+	uring.cqes=(struct io_uring_cqe*)(ring+p.cq_off.cqes);
+
+	// register the provided buffers used by recv operations
+	uring.br=mmap(0,URING_BUFS*sizeof(struct io_uring_buf),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if (uring.br==MAP_FAILED) {
+		uring.br=0;
+		goto fail;
+	}
+	if (!(uring.bufs=(char*)malloc(URING_BUFS*URING_BUFSIZE)))
+		goto fail;
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr=(__u64)(unsigned long)uring.br;
+	reg.ring_entries=URING_BUFS;
+	reg.bgid=0;
+	if (syscall(__NR_io_uring_register,uring.fd,IORING_REGISTER_PBUF_RING,&reg,1))
+		goto fail;
+	for (i=0;i<URING_BUFS;i++)
+		carehttp_uring_recycle(i);
+	__atomic_store_n(&uring.br->tail,(unsigned short)uring.brtail,__ATOMIC_RELEASE);
+
+	uring.active=1;
+	return;
+
+	fail:
+	carehttp_uring_shutdown();
+}
+
+// arms a multishot accept for listeners or a recv for connections
+static int carehttp_uring_arm(struct carehttp_connection *cur) {
+	struct io_uring_sqe *sqe=carehttp_uring_sqe(cur->parent?IORING_OP_RECV:IORING_OP_ACCEPT,cur->handle,(unsigned long)cur,cur->parent?URING_RECV:URING_ACCEPT);
+	if (!sqe)
+		return 0; // try again during the next poll
+	if (cur->parent) {
+		sqe->flags=IOSQE_BUFFER_SELECT;
+		sqe->buf_group=0;
+		if (!uring.single_recv)
+			sqe->ioprio=IORING_RECV_MULTISHOT;
+	} else {
+		sqe->ioprio=IORING_ACCEPT_MULTISHOT;
+	}
+	cur->uring_recv=1;
+	cur->uring_ops++;
+	return 1;
+}
+
+// cancels an armed recv (or accept for listeners) so that input isn't read any more
+static void carehttp_uring_cancel(struct carehttp_connection *cur) {
+	struct io_uring_sqe *sqe=carehttp_uring_sqe(IORING_OP_ASYNC_CANCEL,-1,0,0);
+	if (!sqe)
+		return;
+	sqe->addr=(__u64)(unsigned long)cur|(cur->parent?URING_RECV:URING_ACCEPT);
+	cur->uring_recv=2;
+}
+
+// starts sending all pending output (buffers followed by events) as one message
+// if nothing is being sent already, returns 1 if a send was queued up.
+static int carehttp_uring_send(struct carehttp_connection *cur) {
+	struct io_uring_sqe *sqe;
+	int i,n=0;
+
+	if (cur->uring_error)
+		return -1;
+	if (cur->uring_send)
+		return 0;
+	// skip past sent buffers
+	while(cur->routidx!=cur->woutidx && cur->roffset>=cur->outbufs[cur->routidx].length) {
+		cur->outbufs[cur->routidx].length=0;
+		cur->routidx=(cur->routidx+1)%OUTBUFS;
+		cur->roffset=0;
+	}
+	// gather up the output buffers
+	cur->uring_ringbytes=0;
+	for (i=cur->routidx;i!=cur->woutidx;i=(i+1)%OUTBUFS) {
+		int off=i==cur->routidx?cur->roffset:0;
+		if (cur->outbufs[i].length<=off)
+			continue;
+		cur->uring_iov[n].iov_base=cur->outbufs[i].data+off;
+		cur->uring_iov[n].iov_len=cur->outbufs[i].length-off;
+		cur->uring_ringbytes+=cur->outbufs[i].length-off;
+		n++;
+	}
+	// and the events once all buffers are included
+	for (i=0;i<cur->evcount && n<URING_IOVS;i++) {
+		struct carehttp_event *ev=cur->evqueue[(cur->evfirst+i)%cur->evcap];
+		int off=i?0:cur->evoffset;
+		cur->uring_iov[n].iov_base=ev->data+off;
+		cur->uring_iov[n].iov_len=ev->length-off;
+		n++;
+	}
+	cur->uring_events=i;
+	if (!n)
+		return 0;
+
+	if (!(sqe=carehttp_uring_sqe(IORING_OP_SENDMSG,cur->handle,(unsigned long)cur,URING_SEND)))
+		return 0;
+	memset(&cur->uring_msg,0,sizeof(cur->uring_msg));
+	cur->uring_msg.msg_iov=cur->uring_iov;
+	cur->uring_msg.msg_iovlen=n;
+	sqe->addr=(__u64)(unsigned long)&cur->uring_msg;
+	sqe->len=1;
+	sqe->msg_flags=MSG_NOSIGNAL;
+	cur->uring_send=1;
+	cur->uring_ops++;
+	return 1;
+}
+
+// consumes sent bytes from the output buffers and events after a send completion
+static void carehttp_uring_sent(struct carehttp_connection *cur,int count) {
+	int ring=count<cur->uring_ringbytes?count:cur->uring_ringbytes;
+	count-=ring;
+	while(ring>0) {
+		struct carehttp_buf *buf=cur->outbufs+cur->routidx;
+		int left=buf->length-cur->roffset;
+		if (ring<left) {
+			cur->roffset+=ring;
+			break;
+		}
+		ring-=left;
+		buf->length=0;
+		cur->routidx=(cur->routidx+1)%OUTBUFS;
+		cur->roffset=0;
+	}
+	while(count>0) {
+		struct carehttp_event *ev=cur->evqueue[cur->evfirst];
+		int left=ev->length-cur->evoffset;
+		if (count<left) {
+			cur->evoffset+=count;
+			break;
+		}
+		// the event was sent in full so let go of it
+		count-=left;
+		carehttp_event_release(ev);
+		cur->evfirst=(cur->evfirst+1)%cur->evcap;
+		cur->evcount--;
+		cur->evoffset=0;
+	}
+}
+
+// makes sure a recv is armed, the data itself is received when completions are reaped.
+static int carehttp_uring_receive(struct carehttp_connection *cur) {
+	if (cur->uring_error)
+		return -1;
+	if (!cur->uring_recv && !cur->peerclosed)
+		carehttp_uring_arm(cur);
+	return 0;
+}
+
+// connections with operations in flight can't be freed yet, they are shut down so the operations complete.
+static int carehttp_uring_busy(struct carehttp_connection *cur) {
+	if (!uring.active || !cur->uring_ops)
+		return 0;
+	if (cur->uring_recv==1)
+		carehttp_uring_cancel(cur);
+	if (cur->handle!=-1)
+		shutdown(cur->handle,SHUT_RDWR);
+	return 1;
+}
+
+// processes all completions, returns the number of processed completions
+static int carehttp_uring_reap() {
+	unsigned head=*uring.cq_head;
+	unsigned tail=__atomic_load_n(uring.cq_tail,__ATOMIC_ACQUIRE);
+	unsigned brtail=uring.brtail;
+	int count=0;
+
+	for (;head!=tail;head++,count++) {
+		struct io_uring_cqe *cqe=uring.cqes+(head&*uring.cq_mask);
+		struct carehttp_connection *cur=(struct carehttp_connection*)(unsigned long)(cqe->user_data&~(__u64)7);
+		int res=cqe->res;
+
+		if (!cur)
+			continue; // cancellations have no connection
+
+		switch(cqe->user_data&7) {
+		case URING_ACCEPT :
+			if (!(cqe->flags&IORING_CQE_F_MORE)) {
+				cur->uring_ops--;
+				cur->uring_recv=0;
+			}
+			if (res>=0)
+				carehttp_new_connection(&connections,cur,res,0);
+			break;
+		case URING_RECV :
+			if (!(cqe->flags&IORING_CQE_F_MORE)) {
+				cur->uring_ops--;
+				cur->uring_recv=0;
+			}
+			if (cqe->flags&IORING_CQE_F_BUFFER) {
+				int bid=cqe->flags>>IORING_CQE_BUFFER_SHIFT;
+				if (res>0 && cur->instate>=0 && carehttp_received(cur,uring.bufs+bid*URING_BUFSIZE,res))
+					cur->uring_error=1;
+				carehttp_uring_recycle(bid);
+			}
+			if (res==0) {
+				cur->peerclosed=1;
+			} else if (res==-EINVAL && !uring.single_recv) {
+				uring.single_recv=1; // an older kernel, re-arm without multishot
+			} else if (res<0 && res!=-ENOBUFS && res!=-ECANCELED) {
+				cur->uring_error=1;
+			}
+			break;
+		case URING_SEND :
+			cur->uring_ops--;
+			if (res<0)
+				cur->uring_error=1;
+			else
+				carehttp_uring_sent(cur,res);
+			cur->uring_send=0;
+			break;
+		}
+	}
+	__atomic_store_n(uring.cq_head,head,__ATOMIC_RELEASE);
+	if (brtail!=uring.brtail)
+		__atomic_store_n(&uring.br->tail,(unsigned short)uring.brtail,__ATOMIC_RELEASE);
+	return count;
+}
+#endif
+
+// returns the number of queued events that are being sent and thus must be kept around.
+static int carehttp_event_busy(struct carehttp_connection *cur) {
+#ifdef CAREHTTP_URING
+	if (cur->uring_send)
+		return cur->uring_events;
+#endif
+	return cur->evoffset>0;
+}
+
 static int rl_nonspace(int c){
 	if (c==0 || c=='\n' || c=='\r')
 		return -1;
@@ -168,16 +860,216 @@ static int str_skip_type(const char *buf,int *idx,int (*f)(int)) {
 	return 0;
 }
 
+// set when draining, no new connections are accepted and connections are closed as soon as they are idle.
+static int draining=0;
+static time_t drainstart;
+
+// seconds that a connection accepted right before draining gets to send its first request
+#define CAREHTTP_DRAIN_GRACE 2
+
+// one time initialization done before the first listener is opened
+static void carehttp_startup() {
+	static int started=0;
+	if (started)
+		return;
+	started=1;
+#ifdef WIN32
+	{
+		WSADATA wsadata;
+		if (WSAStartup( MAKEWORD(1,0),&wsadata) ) {
+			fprintf(stderr,"Winsock startup problem\n");
+			exit(-1);
+		}
+		wsIsInit=1;
+	}
+#endif
+#ifdef CAREHTTP_URING
+	carehttp_uring_init();
+#endif
+}
+
+// opens the listening socket of a listener record, the handle is -1 if it failed.
+static int carehttp_bind_listener(struct carehttp_connection *nc) {
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in;
+#ifndef WIN32
+		struct sockaddr_un un;
+#endif
+	} addr;
+	int addrsize;
+
+	memset(&addr,0,sizeof(addr));
+	if (nc->path) {
+#ifdef WIN32
+		fprintf(stderr,"Unix domain sockets are not supported (%s)\n",nc->path);
+		return nc->handle=-1;
+#else
+		int len=strlen(nc->path);
+		if (len>=(int)sizeof(addr.un.sun_path)) {
+			fprintf(stderr,"Socket path too long %s\n",nc->path);
+			return nc->handle=-1;
+		}
+		addr.un.sun_family=AF_UNIX;
+		memcpy(addr.un.sun_path,nc->path,len);
+		addrsize=offsetof(struct sockaddr_un,sun_path)+len;
+		if (nc->path[0]=='@') {
+			addr.un.sun_path[0]=0; // abstract namespace sockets don't exist in the filesystem
+		} else {
+			// remove a stale socket file left behind by an earlier process but never anything else
+			struct stat st;
+			addrsize++;
+			if (!lstat(nc->path,&st)) {
+				int probe,stale=0;
+				if (!S_ISSOCK(st.st_mode)) {
+					fprintf(stderr,"Not replacing %s since it isn't a socket\n",nc->path);
+					return nc->handle=-1;
+				}
+				// a socket that someone still accepts connections on isn't stale
+				if (-1!=(probe=socket(AF_UNIX,SOCK_STREAM,0))) {
+					carehttp_socket_set_nonblocking(probe);
+					stale=connect(probe,&addr.sa,addrsize) && errno==ECONNREFUSED;
+					closesocket(probe);
+				}
+				if (!stale) {
+					fprintf(stderr,"Not replacing %s since it's in use\n",nc->path);
+					return nc->handle=-1;
+				}
+				unlink(nc->path);
+			}
+		}
+		if (-1==(nc->handle=socket(AF_UNIX,SOCK_STREAM,0))) {
+			fprintf(stderr,"Could not open create socket for %s\n",nc->path);
+			return -1;
+		}
+#endif
+	} else {
+#ifndef WIN32
+		int reuse=1;
+#endif
+		if (-1==(nc->handle=socket(PF_INET,SOCK_STREAM,IPPROTO_TCP))) {
+			fprintf(stderr,"Could not open create socket for port %d\n",nc->port);
+			return -1;
+		}
+#ifndef WIN32
+		// allow a restarted server to bind while old connections linger in TIME_WAIT
+		setsockopt(nc->handle,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+#endif
+		addr.in.sin_family=AF_INET;
+		addr.in.sin_addr.s_addr=0;
+		addr.in.sin_port=htons(nc->port);
+		addrsize=sizeof(addr.in);
+	}
+	if (bind(nc->handle,&addr.sa,addrsize)) {
+		if (nc->path)
+			fprintf(stderr,"Could not bind %s\n",nc->path);
+		else
+			fprintf(stderr,"Could not bind port %d\n",nc->port);
+		closesocket(nc->handle);
+		return nc->handle=-1;
+	}
+	if (listen(nc->handle,50)) {
+		if (nc->path)
+			fprintf(stderr,"Could not listen on %s\n",nc->path);
+		else
+			fprintf(stderr,"Could not listen on port %d\n",nc->port);
+		closesocket(nc->handle);
+		return nc->handle=-1;
+	}
+	carehttp_socket_set_nonblocking(nc->handle);
+	return 0;
+}
+
+// creates a listener record at the end of the connection list, the record is kept even if the
+// socket couldn't be opened so that carehttp_poll doesn't retry opening it on every call.
+static struct carehttp_connection* carehttp_new_listener(int port,const char *path,int fd) {
+	struct carehttp_connection **pcon=&connections;
+	// this below is assumed to succeed since it is to be run upon startup.
+	struct carehttp_connection *nc=(struct carehttp_connection*)calloc(1,sizeof(struct carehttp_connection));
+	if (!nc || (path && !(nc->path=(char*)malloc(strlen(path)+1)))) {
+		fprintf(stderr,"Error, could not allocate memory for an listening socked\n");
+		exit(-1);
+	}
+	nc->port=port;
+	if (path)
+		strcpy(nc->path,path);
+
+	carehttp_startup();
+
+	if (fd!=-1) {
+		// an already listening socket
+		nc->handle=fd;
+		carehttp_socket_set_nonblocking(fd);
+	} else {
+		carehttp_bind_listener(nc);
+	}
+
+	while(*pcon)
+		pcon=&(*pcon)->next;
+	*pcon=nc;
+	return nc;
+}
+
+// finds the listener for a port or path
+static struct carehttp_connection* carehttp_find_listener(int port,const char *path) {
+	struct carehttp_connection *cur;
+	for (cur=connections;cur;cur=cur->next) {
+		if (cur->parent)
+			continue;
+		if (path?(cur->path && !strcmp(cur->path,path)):(!cur->path && !cur->transport && cur->port==port))
+			return cur;
+	}
+	return 0;
+}
+
+void* carehttp_listen(int port) {
+	struct carehttp_connection *cur=carehttp_find_listener(port,0);
+	// while draining the listeners are closed but the handles stay valid for polling the remaining connections
+	if (draining)
+		return cur;
+	if (!cur)
+		cur=carehttp_new_listener(port,0,-1);
+	else if (cur->handle==-1)
+		carehttp_bind_listener(cur); // retry opening a failed listener
+	return cur->handle!=-1?cur:0;
+}
+
+void* carehttp_listen_unix(const char *path) {
+	struct carehttp_connection *cur=carehttp_find_listener(0,path);
+	if (draining)
+		return cur;
+	if (!cur)
+		cur=carehttp_new_listener(0,path,-1);
+	else if (cur->handle==-1)
+		carehttp_bind_listener(cur); // retry opening a failed listener
+	return cur->handle!=-1?cur:0;
+}
+
 // poll listening on the specified port and for connections on port-associated sockets
 void* carehttp_poll(int port) {
-	struct carehttp_connection **pcon=&connections; // keep a pointer to the previous link to a connection so we can update
+	struct carehttp_connection *listener=carehttp_find_listener(port,0);
+
+	// no connection listening at the port was found so proceed to create a connection for this purpose
+	// (unless we're draining and shouldn't accept any new connections)
+	if (!listener && !draining)
+		listener=carehttp_new_listener(port,0,-1);
 
-	int found_at_port=0;    // is the requested port opened?
-	int first_connection=1; // is this the first connection we will open?
+	return carehttp_poll_listener(listener);
+}
+
+// poll all listeners and for connections accepted from the specified listener
+void* carehttp_poll_listener(void *listener) {
+	struct carehttp_connection **pcon=&connections; // keep a pointer to the previous link to a connection so we can update
 
-	void *outval=0; // will be a header complete connection opened from the same port as specified in the argument
+	void *outval=0; // will be a header complete connection opened from the specified listener
 	int work=0;     // work flag indicates if this function should sleep when finished
 
+#ifdef CAREHTTP_URING
+	// take care of everything that the kernel has finished since the last poll
+	if (uring.active && carehttp_uring_reap())
+		work=1;
+#endif
+
 	// process all active connections and listeners
 	while(*pcon) {
 		struct carehttp_connection *cur=*pcon;
@@ -185,13 +1077,6 @@ void* carehttp_poll(int port) {
 		// parentless connections are listeners
 		if (!cur->parent) {
 			int sock=-1;
-			struct carehttp_connection *newconn;
-			struct sockaddr_in sa;
-#ifdef WIN32
-			int sasize=sizeof(sa);
-#else
-			socklen_t sasize=sizeof(sa);
-#endif
 
 #ifdef VERBOSE
 #if VERBOSELEVEL >= 5
@@ -199,35 +1084,32 @@ void* carehttp_poll(int port) {
 #endif
 #endif
 
-			first_connection=0; // a newly created one cannot be the first connection since we've already have one open!
-			if (cur->instate==port)
-				found_at_port=1; // we have the argument port open!
-
+			if (cur->transport) {
+				// transports are asked for new connections unless we're draining
+				void *ctx;
+				if (!draining && cur->transport->accept(cur->ctx,&ctx)>0) {
+					work=1;
+					carehttp_new_connection(pcon,cur,-1,ctx);
+				}
+			} else
+#ifdef CAREHTTP_URING
+			// with io_uring a multishot accept is kept armed and new connections are created when reaping.
+			if (uring.active) {
+				if (cur->handle!=-1 && !cur->uring_recv)
+					carehttp_uring_arm(cur);
+			} else
+#endif
 			// accept call is done if we have a valid handle, this accepts new sockets from a listening port.
 			if (cur->handle!=-1)
-				sock=accept(cur->handle,(struct sockaddr*)&sa,&sasize);
+				sock=accept(cur->handle,0,0);
 
 			if (sock!=-1) {
 				work=1;
-				// a new socket was opened, allocate an associated connection
-				newconn=(struct carehttp_connection*)calloc(1,sizeof(struct carehttp_connection));
-#ifdef VERBOSE
-				fprintf(stderr,"Got a new connection %p:%d\n",newconn,sock);
-#endif
-				if (!newconn) {
-					// not enough memory, close it and continue processing.
-					closesocket(sock);
-				} else {
-					newconn->parent=cur;  // set the parent port
-					newconn->handle=sock; // set the socket
-					carehttp_socket_set_nonblocking(sock); // and make it non-blocking
-					newconn->next=*pcon;
-					*pcon=newconn;
-				}
+				carehttp_new_connection(pcon,cur,sock,0);
 			}
-		} else if (cur->parent->instate==port && !outval) {
+		} else if (cur->parent==listener && !outval) {
 			// data socket not a listening socket, so let's handle processing here!
-			// also only handle processing for those connections matching the polled port while there hasn't been a completed request yet.
+			// also only handle processing for those connections matching the polled listener while there hasn't been a completed request yet.
 
 #ifdef VERBOSE
 #if VERBOSELEVEL > 3
@@ -240,86 +1122,170 @@ void* carehttp_poll(int port) {
 				conerr:
 #ifdef VERBOSE
 					fprintf(stderr,"Closing conn %p with socket %d\n",cur,cur->handle);
+#endif
+					cur->instate=-1;
+#ifdef CAREHTTP_URING
+					// the kernel must be done with the connection before it can be cleaned up
+					if (carehttp_uring_busy(cur)) {
+						pcon=&cur->next;
+						continue;
+					}
 #endif
 					// close our socket
-					if (cur->handle!=-1)
+					if (cur->transport)
+						cur->transport->close(cur->ctx);
+					else if (cur->handle!=-1)
 						closesocket(cur->handle);
 					cur->handle=-1;
+					cur->transport=0;
+					cur->ctx=0;
 					// free our buffers
 					if (cur->inbuf.data)
 						free(cur->inbuf.data);
-					cur->inbuf.data=0;
+					memset(&cur->inbuf,0,sizeof(cur->inbuf));
 					for (i=0;i<OUTBUFS;i++) {
 						if (cur->outbufs[i].data)
 							free(cur->outbufs[i].data);
-						cur->outbufs[i].data=0;
+						memset(cur->outbufs+i,0,sizeof(cur->outbufs[i]));
 					}
+					if (cur->wsmsg.data)
+						free(cur->wsmsg.data);
+					memset(&cur->wsmsg,0,sizeof(cur->wsmsg));
+					// and any queued events
+					for (i=0;i<cur->evcount;i++)
+						carehttp_event_release(cur->evqueue[(cur->evfirst+i)%cur->evcap]);
+					if (cur->evqueue)
+						free(cur->evqueue);
+					cur->evqueue=0;
+					cur->evcount=0;
+					carehttp_sse_unsubscribe(cur);
 					// unlink this ptr if it isn't visible
 					if (!cur->visible) {
 						*pcon=cur->next;
 						free(cur);
+						continue;
+					}
+					// websocket users are told with a close message
+					if (cur->websocket==1 && !outval) {
+						cur->websocket=2;
+						cur->wsready=CAREHTTP_WS_CLOSE;
+						cur->wantwrite=0;
+						cur->resumed=0;
+						outval=cur;
+						work=1;
+					}
+					// a user waiting for a writable notification is told about the error instead
+					if (cur->wantwrite && !outval) {
+						cur->wantwrite=0;
+						cur->resumed=1;
+						outval=cur;
+						work=1;
 					}
-					continue;
 			} else {
 				int rc;
 				int i;
-				// while we have buffers pending to be sent to the network queue them up for sending.
-				while(cur->routidx!=cur->woutidx) {
-					int wr;
-					// take the first buffer
-					struct carehttp_buf *buf=cur->outbufs+cur->routidx;
-					
-					// is this buffer empty or did we finish sending?
-					if (cur->roffset>=buf->length) {
-						// if so, advance to the next buffer
-						cur->routidx=(cur->routidx+1)%OUTBUFS;
-						// begin from the start of that one.
-						cur->roffset=0;
-						// and clear this output buffer for the next round of data.
-						buf->length=0;
-						// go to the next output buffer
-						continue;
-					}
-					
-					// try to send the remainder in one go if possible.
-					wr=send(cur->handle,buf->data+cur->roffset,buf->length-cur->roffset,0);
-					if (wr<0) {
-						// blocking or some kind of error
-						if (!carehttp_socket_wasblock(cur->handle))
-							goto conerr; // not blocking so an real error
-					} else {
-						work|=wr>0;
-						// consume the sent amount of bytes
-						cur->roffset+=wr;
-						// finished sending?
-						if (cur->roffset==buf->length) {
-							continue;
-						} else {
-							// could not send all pending data in the buffer so let's try again later.
-							break;
-						}
-					}
+
+				// a websocket message handed out by the previous poll is no longer valid
+				if (cur->wsready) {
+					cur->wsready=0;
+					cur->wsmsg.length=0;
+				}
+				// websocket frames are queued up as soon as the previous ones are sent
+				if (cur->instate==2 && carehttp_can_commit(cur)) {
+					if (carehttp_flush_body(cur)<0)
+						goto conerr;
 				}
-				// read in some data
-				rc=recv(cur->handle,tmpbuf,sizeof(tmpbuf),0);
-				if (rc<0) {
-					if (!carehttp_socket_wasblock(cur->handle))
-						goto conerr; // A real error so we need to close and clean up
-				} else if (rc>0) {
-					if (carehttp_buf_reserve(&cur->inbuf,cur->inbuf.length+rc+1)) {
-						// error allocating memory, clean up the connection
+
+				// send out any pending output
+#ifdef CAREHTTP_URING
+				if (uring.active && !cur->transport)
+					rc=carehttp_uring_send(cur);
+				else
+#endif
+				rc=carehttp_send_pending(cur);
+				if (rc<0)
+					goto conerr;
+				work|=rc;
+
+				// a finished streaming response might still be waiting for space to queue up the last chunk
+				if (cur->finishing && carehttp_can_commit(cur))
+					carehttp_commit_response(cur);
+
+				// while draining idle connections are closed and long lived ones are asked to close
+				if (draining) {
+					if (cur->instate==0 && !cur->inbuf.length && !carehttp_pending(cur) && (cur->served || time(0)-drainstart>=CAREHTTP_DRAIN_GRACE))
 						goto conerr;
+					if (cur->instate==3)
+						cur->closing=1;
+					if (cur->instate==2 && cur->websocket==1 && cur->visible && !outval) {
+						if (carehttp_ws_frame(cur,CAREHTTP_WS_CLOSE,"\x03\xe9",2)<0) // 1001 going away
+							goto conerr;
+						cur->websocket=2;
+						cur->wsready=CAREHTTP_WS_CLOSE;
+						cur->wsmsg.length=0;
+						cur->closing=1;
+						cur->resumed=0;
+						outval=cur;
+						work=1;
 					}
-					memcpy(cur->inbuf.data+cur->inbuf.length,tmpbuf,rc); // add new data
-					cur->inbuf.length+=rc; // update length
-					cur->inbuf.data[cur->inbuf.length]=0; // null terminate the buffer
+				}
+
+				// connections that are to be closed are closed once everything has been sent.
+				if (cur->closing && cur->routidx==cur->woutidx && !cur->outbufs[cur->woutidx].length && !cur->outbufs[cur->woutidx+1].length && !cur->evcount)
+					goto conerr;
+
+				// tell users that had a write refused when there is room to continue writing
+				if (cur->wantwrite && !outval && carehttp_can_commit(cur) && carehttp_pending(cur)<cur->highwater) {
+					if (carehttp_flush_body(cur)<0)
+						goto conerr;
+					cur->wantwrite=0;
+					cur->resumed=1;
+					outval=cur;
 					work=1;
 				}
-				// do header parsing assuming we are in that input state and have space to produce new output!
-				if (cur->instate==0 && ((cur->woutidx+2)%OUTBUFS)!=cur->routidx && ((cur->woutidx+3)%OUTBUFS)!=cur->routidx) {
-					for (;cur->headinfo.headsize<cur->inbuf.length-3;cur->headinfo.headsize++) {
-						if (memcmp(cur->inbuf.data+cur->headinfo.headsize,"\r\n\r\n",4))
-							continue;
+
+				// don't read or parse more input while too much output is waiting to be sent
+				// (this leaves the data in the socket buffers so that the client is slowed down)
+				if (carehttp_output_full(cur)) {
+#ifdef VERBOSE
+					fprintf(stderr,"Cannot process input yet... waiting for data to be flushed!\n");
+#endif
+#ifdef CAREHTTP_URING
+					if (uring.active && cur->uring_recv==1)
+						carehttp_uring_cancel(cur);
+#endif
+					pcon=&cur->next;
+					continue;
+				}
+
+				// read in some data, unless the output can't take another response or a whole request is waiting
+				// already since a client that pipelines requests without reading the responses could fill our memory.
+				if (!carehttp_can_commit(cur) || carehttp_request_buffered(cur)) {
+#ifdef CAREHTTP_URING
+					if (uring.active && cur->uring_recv==1)
+						carehttp_uring_cancel(cur);
+#endif
+					rc=0;
+				} else
+#ifdef CAREHTTP_URING
+				if (uring.active && !cur->transport)
+					rc=carehttp_uring_receive(cur);
+				else
+#endif
+				rc=carehttp_receive(cur);
+				if (rc<0)
+					goto conerr;
+				work|=rc;
+				// websockets and event streams are closed directly when the other end has closed while
+				// http connections are closed when there are no more requests to respond to.
+				if (cur->peerclosed && (cur->instate==2 || cur->instate==3))
+					goto conerr;
+
+				// do header parsing assuming we are in that input state and have space to produce new output!
+				if (cur->instate==0 && carehttp_can_commit(cur)) {
+					for (;cur->headinfo.headsize<cur->inbuf.length-3;cur->headinfo.headsize++) {
+						if (memcmp(cur->inbuf.data+cur->headinfo.headsize,"\r\n\r\n",4))
+							continue;
 						cur->instate=1;
 						cur->headinfo.headsize+=4;
 						break;
@@ -368,9 +1334,24 @@ void* carehttp_poll(int port) {
 						}
 						// flag the output
 						cur->visible=1;
+						cur->resumed=0;
 						outval=cur;
 						work=1;
 					}
+				} else if (cur->instate==3) {
+					// event stream clients have nothing to say so any input is ignored.
+					cur->inbuf.length=0;
+				} else if (cur->instate==2) {
+					// decode websocket frames until a message is ready for the user.
+					if (cur->visible && cur->websocket==1) {
+						if (carehttp_ws_parse(cur)<0)
+							goto conerr;
+						if (cur->wsready) {
+							cur->resumed=0;
+							outval=cur;
+							work=1;
+						}
+					}
 				} else {
 					if (cur->instate==0) {
 #ifdef VERBOSE
@@ -378,6 +1359,9 @@ void* carehttp_poll(int port) {
 #endif
 					}
 				}
+				// with the other end closed and no request in progress there is nothing more to do.
+				if (cur->peerclosed && cur->instate==0 && !carehttp_pending(cur))
+					goto conerr;
 				// en of non-error processing.
 			}
 		}
@@ -385,56 +1369,16 @@ void* carehttp_poll(int port) {
 		pcon=&cur->next;
 	}
 
-	// no connection listening at the port was found so proceed to create a connection for this purpose
-	if (!found_at_port) {
-		// this below is assumed to succeed since it is to be run upon startup.
-		struct carehttp_connection *nc=*pcon=(struct carehttp_connection*)malloc(sizeof(struct carehttp_connection));
-		if (!nc) {
-			fprintf(stderr,"Error, could not allocate memory for an listening socked\n");
-			exit(-1);
-		}
-		nc->instate=port;
-		nc->parent=0;
-		nc->next=0;
+	// transports are driven by the user so polling them never sleeps
+	if (listener && ((struct carehttp_connection*)listener)->transport)
+		work=1;
 
-#ifdef WIN32
-		if (first_connection) { 
-			WSADATA wsadata;
-			if (WSAStartup( MAKEWORD(1,0),&wsadata) ) {
-				fprintf(stderr,"Winsock startup problem\n");
-				exit(-1);
-			}
-			wsIsInit=1;
-		}
+#ifdef CAREHTTP_URING
+	// submit everything that was queued up during this poll at once (waiting for completions instead of sleeping)
+	if (uring.active)
+		carehttp_uring_enter(work?0:10);
+	else
 #endif
-
-		do {
-			struct sockaddr_in sa;
-			if (-1==(nc->handle=socket(PF_INET,SOCK_STREAM,IPPROTO_TCP))) {
-				fprintf(stderr,"Could not open create socket for port %d\n",port);
-				break;
-			}
-			memset(&sa,0,sizeof(sa));
-			sa.sin_family=AF_INET;
-			sa.sin_addr.s_addr=0;
-			sa.sin_port=htons(port);
-			if (bind(nc->handle,(struct sockaddr*)&sa,sizeof(sa))) {
-				fprintf(stderr,"Could not bind port %d\n",port);
-				closesocket(nc->handle);
-				nc->handle=-1;
-				break;
-			}
-			if (listen(nc->handle,50)) {
-				fprintf(stderr,"Could not listen on port %d\n",port);
-				closesocket(nc->handle);
-				nc->handle=-1;
-				break;
-			}
-			carehttp_socket_set_nonblocking(nc->handle);
-			work=1;
-		} while(0);
-	}
-
 	if (!work) {
 #ifdef WIN32
 		Sleep(1);
@@ -446,51 +1390,188 @@ void* carehttp_poll(int port) {
 	return outval;
 }
 
+// preformatted status lines so that the common response codes can be copied out directly.
+// this table MUST be kept sorted by code since it's binary searched.
+#define STATUSLINE(code,text) { code, sizeof("HTTP/1.1 " #code " " text "\r\n")-1, "HTTP/1.1 " #code " " text "\r\n" }
+static const struct carehttp_status {
+	int code;
+	int length;
+	const char *line;
+} carehttp_statuses[]={
+	STATUSLINE(100,"Continue"),
+	STATUSLINE(101,"Switching Protocols"),
+	STATUSLINE(102,"Processing"),
+	STATUSLINE(103,"Early Hints"),
+	STATUSLINE(200,"OK"),
+	STATUSLINE(201,"Created"),
+	STATUSLINE(202,"Accepted"),
+	STATUSLINE(203,"Non-Authoritative Information"),
+	STATUSLINE(204,"No Content"),
+	STATUSLINE(205,"Reset Content"),
+	STATUSLINE(206,"Partial Content"),
+	STATUSLINE(207,"Multi-Status"),
+	STATUSLINE(208,"Already Reported"),
+	STATUSLINE(226,"IM Used"),
+	STATUSLINE(300,"Multiple Choices"),
+	STATUSLINE(301,"Moved Permanently"),
+	STATUSLINE(302,"Found"),
+	STATUSLINE(303,"See Other"),
+	STATUSLINE(304,"Not Modified"),
+	STATUSLINE(305,"Use Proxy"),
+	STATUSLINE(307,"Temporary Redirect"),
+	STATUSLINE(308,"Permanent Redirect"),
+	STATUSLINE(400,"Bad Request"),
+	STATUSLINE(401,"Unauthorized"),
+	STATUSLINE(402,"Payment Required"),
+	STATUSLINE(403,"Forbidden"),
+	STATUSLINE(404,"Not Found"),
+	STATUSLINE(405,"Method Not Allowed"),
+	STATUSLINE(406,"Not Acceptable"),
+	STATUSLINE(407,"Proxy Authentication Required"),
+	STATUSLINE(408,"Request Timeout"),
+	STATUSLINE(409,"Conflict"),
+	STATUSLINE(410,"Gone"),
+	STATUSLINE(411,"Length Required"),
+	STATUSLINE(412,"Precondition Failed"),
+	STATUSLINE(413,"Content Too Large"),
+	STATUSLINE(414,"URI Too Long"),
+	STATUSLINE(415,"Unsupported Media Type"),
+	STATUSLINE(416,"Range Not Satisfiable"),
+	STATUSLINE(417,"Expectation Failed"),
+	STATUSLINE(418,"I'm a teapot"),
+	STATUSLINE(421,"Misdirected Request"),
+	STATUSLINE(422,"Unprocessable Content"),
+	STATUSLINE(423,"Locked"),
+	STATUSLINE(424,"Failed Dependency"),
+	STATUSLINE(425,"Too Early"),
+	STATUSLINE(426,"Upgrade Required"),
+	STATUSLINE(428,"Precondition Required"),
+	STATUSLINE(429,"Too Many Requests"),
+	STATUSLINE(431,"Request Header Fields Too Large"),
+	STATUSLINE(451,"Unavailable For Legal Reasons"),
+	STATUSLINE(500,"Internal Server Error"),
+	STATUSLINE(501,"Not Implemented"),
+	STATUSLINE(502,"Bad Gateway"),
+	STATUSLINE(503,"Service Unavailable"),
+	STATUSLINE(504,"Gateway Timeout"),
+	STATUSLINE(505,"HTTP Version Not Supported"),
+	STATUSLINE(506,"Variant Also Negotiates"),
+	STATUSLINE(507,"Insufficient Storage"),
+	STATUSLINE(508,"Loop Detected"),
+	STATUSLINE(510,"Not Extended"),
+	STATUSLINE(511,"Network Authentication Required"),
+};
+#undef STATUSLINE
+
+static const struct carehttp_status* carehttp_status_line(int code) {
+	const int count=(int)(sizeof(carehttp_statuses)/sizeof(carehttp_statuses[0]));
+	int lo=0,hi=count;
+	while(lo<hi) {
+		int mid=(lo+hi)>>1;
+		if (carehttp_statuses[mid].code<code)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	if (lo<count && carehttp_statuses[lo].code==code)
+		return carehttp_statuses+lo;
+	return 0;
+}
+
+// the Date header only changes once per second so it's formatted once and then shared by all responses.
+// (the day and month names are spelled out here since strftime is locale dependant)
+static char carehttp_date[64];
+static int carehttp_date_length;
+static time_t carehttp_date_time=-1;
+
+static void carehttp_update_date() {
+	static const char days[7][4]={"Sun","Mon","Tue","Wed","Thu","Fri","Sat"};
+	static const char months[12][4]={"Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"};
+	time_t now=time(0);
+	struct tm *tm;
+
+	if (now==carehttp_date_time)
+		return;
+	if (!(tm=gmtime(&now)))
+		return; // keep the old date around
+	carehttp_date_time=now;
+	carehttp_date_length=sprintf(carehttp_date,"Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n",
+		days[tm->tm_wday],tm->tm_mday,months[tm->tm_mon],tm->tm_year+1900,tm->tm_hour,tm->tm_min,tm->tm_sec);
+}
+
 int carehttp_responsecode(void *conn,int code) {
 	struct carehttp_connection *cur=conn;
 	struct carehttp_buf *buf=cur->outbufs+(cur->woutidx);
-	const char *err="OK";
+	const struct carehttp_status *status;
 
-	if (cur->instate<0)
+	if (cur->instate!=1)
 		return -1;
 
-	if (buf->length)
+	if (buf->length || cur->streaming)
 		return 1; // don't update an already set response code
 
-	switch(code) {
-	case 200 : err="OK"; break;
-	case 404 : err="Not found"; break;
-	default:   err="Err"; break;
+	cur->headinfo.status=code;
+	if ((status=carehttp_status_line(code))) {
+		if (carehttp_buf_append(buf,status->line,status->length)) {
+			cur->instate=-1; // out of memory, shut down this connection.
+			return -1;
+		}
+	} else {
+		// unknown codes are rare enough to be formatted on the fly
+		if (carehttp_buf_reserve(buf,buf->length+40)) {
+			cur->instate=-1;
+			return -1;
+		}
+		buf->length+=sprintf(buf->data+buf->length,"HTTP/1.1 %3d Unknown\r\n",code%1000);
 	}
 
-	if (carehttp_buf_reserve(buf,buf->length+20+strlen(err))) { // approximate reserve
-		cur->instate=-1; // out of memory, shut down this connection.
+	// every response carries a date
+	carehttp_update_date();
+	if (carehttp_buf_append(buf,carehttp_date,carehttp_date_length)) {
+		cur->instate=-1;
 		return -1;
 	}
-	buf->length+=sprintf(buf->data+buf->length,"HTTP/1.1 %3d %s\r\n",code,err);
 	return 0;
 }
-int carehttp_set_header(void *conn,const char *head,const char *data) {
-	struct carehttp_connection *cur=conn;
-	struct carehttp_buf *buf=cur->outbufs+(cur->woutidx);
 
-	if (cur->instate<0)
-		return -1;
+// appends a header line with known lengths
+static int carehttp_add_header(struct carehttp_connection *cur,const char *head,int headlen,const char *data,int datalen) {
+	struct carehttp_buf *buf=cur->outbufs+(cur->woutidx);
+	char *wp;
 
 	// make a default 200 response incase we haven't already
 	if (!buf->length) {
-		if (carehttp_responsecode(conn,200)<0)
+		if (carehttp_responsecode(cur,200)<0)
 			return -1;
 	}
-	// reserve memory for response code
-	if (carehttp_buf_reserve(buf,buf->length+strlen(head)+strlen(data)+5)) {
+	// reserve memory for the header line
+	if (carehttp_buf_reserve(buf,buf->length+headlen+datalen+5)) {
 		cur->instate=-1;
 		return -1;
 	}
-	buf->length+=sprintf(buf->data+buf->length,"%s: %s\r\n",head,data);
+	wp=buf->data+buf->length;
+	memcpy(wp,head,headlen);
+	wp+=headlen;
+	*wp++=':';
+	*wp++=' ';
+	memcpy(wp,data,datalen);
+	wp+=datalen;
+	*wp++='\r';
+	*wp++='\n';
+	*wp=0;
+	buf->length=wp-buf->data;
 
 	return 0;
 }
+
+int carehttp_set_header(void *conn,const char *head,const char *data) {
+	struct carehttp_connection *cur=conn;
+
+	if (cur->instate!=1 || cur->streaming)
+		return -1; // errors or headers already sent
+
+	return carehttp_add_header(cur,head,strlen(head),data,strlen(data));
+}
 int carehttp_match(void *conn,const char *fmt,...) {
 	va_list args;
 	struct carehttp_connection *cur=conn;
@@ -670,67 +1751,224 @@ int carehttp_get_param(void *conn,char *out,int outsize,const char *name) {
 	return ol;
 }
 
+// wraps the data in the current body buffer as a chunk, the chunk size line goes
+// into the head buffer so that the body data doesn't need to be moved.
+static int carehttp_frame_chunk(struct carehttp_connection *cur) {
+	struct carehttp_buf *head=cur->outbufs+cur->woutidx;
+	struct carehttp_buf *body=head+1;
+	char tmp[16];
+	char *wp=tmp+sizeof(tmp);
+	unsigned int v=body->length;
+
+	*--wp='\n';
+	*--wp='\r';
+	do {
+		*--wp="0123456789abcdef"[v&15];
+		v>>=4;
+	} while(v);
+	if (carehttp_buf_append(head,wp,tmp+sizeof(tmp)-wp)<0)
+		return -1;
+	return carehttp_buf_append(body,"\r\n",2);
+}
+
+// flushes the current body as a chunk of a chunked response, the headers are sent ahead with the first chunk.
+// http/1.0 clients don't understand chunks so their body is sent as is and ended by closing the connection.
+// this MUST only be called when carehttp_can_commit is true.
+static int carehttp_flush_body(struct carehttp_connection *cur) {
+	struct carehttp_buf *head=cur->outbufs+cur->woutidx;
+
+	if (!cur->outbufs[cur->woutidx+1].length)
+		return 0; // nothing to send
+
+	// websocket frames are complete already
+	if (cur->instate==2) {
+		cur->woutidx=(cur->woutidx+2)%OUTBUFS;
+		return 0;
+	}
+
+	if (!cur->streaming) {
+		if (!strcmp(cur->inbuf.data+cur->headinfo.version_index,"HTTP/1.0")) {
+			if (carehttp_add_header(cur,"Connection",10,"close",5)<0)
+				return -1;
+			cur->streaming=2;
+		} else {
+			if (carehttp_add_header(cur,"Transfer-Encoding",17,"chunked",7)<0)
+				return -1;
+			cur->streaming=1;
+		}
+		if (carehttp_buf_append(head,"\r\n",2)<0)
+			return -1;
+	}
+
+	if (cur->streaming==1 && carehttp_frame_chunk(cur)<0)
+		return -1;
+
+	// and queue it for sending.
+	cur->woutidx=(cur->woutidx+2)%OUTBUFS;
+	return 0;
+}
+
+// queues up a finished response for sending and resets the request state so the next request can be parsed.
+static void carehttp_commit_response(struct carehttp_connection *cur) {
+	// swap the buffers
+	cur->woutidx=(cur->woutidx+2)%OUTBUFS;
+
+	// on the request side dump the request header data to process the next request on this socket.
+	memmove(cur->inbuf.data,cur->inbuf.data+cur->headinfo.headsize,cur->inbuf.length-cur->headinfo.headsize);
+	cur->inbuf.length-=cur->headinfo.headsize;
+	cur->instate=0; // reset the parsing state once we've finished
+	memset(&cur->headinfo,0,sizeof(cur->headinfo));
+	if (draining)
+		cur->closing=1; // no more keep-alive when draining
+	cur->served=1;
+	cur->streaming=0;
+	cur->finishing=0;
+	cur->wantwrite=0;
+}
+
+// makes sure that there is room in the body buffer for more data on connections with a highwater.
+// returns CAREHTTP_WOULDBLOCK if the user needs to wait for a writable notification.
+static int carehttp_body_room(struct carehttp_connection *cur) {
+	if (cur->highwater<=0 || cur->outbufs[cur->woutidx+1].length<cur->highwater)
+		return 0;
+	if (!carehttp_can_commit(cur)) {
+		cur->wantwrite=1;
+		return CAREHTTP_WOULDBLOCK;
+	}
+	if (carehttp_flush_body(cur)<0) {
+		cur->instate=-1;
+		return -1;
+	}
+	return 0;
+}
+
 int carehttp_printf(void *conn,const char *fmt,...) {
 	struct carehttp_connection *cur=conn;
-	struct carehttp_buf *buf=cur->outbufs+(cur->woutidx+1);
+	struct carehttp_buf *buf;
 	int len;
 	va_list args;
 
-	if (cur->instate<0)
+	if (cur->instate!=1)
 		return -1;
 
-	// calculate space (TODO: add support for compilers that doesn't support vsnprintf?)
-	va_start(args,fmt);
-	len=1+vsnprintf(NULL,0,fmt,args);
-	va_end(args);
+	if ((len=carehttp_body_room(cur)))
+		return len;
+	buf=cur->outbufs+(cur->woutidx+1);
 
-	if (carehttp_buf_reserve(buf,buf->length+len+1)) {
+	// make sure there is some spare room to print into
+	if (carehttp_buf_reserve(buf,buf->length+1)) {
 		cur->instate=-1;
-		return -1; // could not print
+		return -1;
 	}
 
-	// now actually print something out and increase the size
+	// try printing directly into the spare capacity (the buffer always has room for a null terminator past cap)
+	// (TODO: add support for compilers that doesn't support vsnprintf?)
 	va_start(args,fmt);
-	buf->length+=len=vsnprintf(buf->data+buf->length,len,fmt,args);
+	len=vsnprintf(buf->data+buf->length,buf->cap-buf->length+1,fmt,args);
 	va_end(args);
 
+	if (len<0) {
+		buf->data[buf->length]=0;
+		return -1; // formatting error
+	}
+
+	// only if the output was truncated do we need to grow the buffer and print again
+	if (len>buf->cap-buf->length) {
+		if (carehttp_buf_reserve(buf,buf->length+len+1)) {
+			cur->instate=-1;
+			return -1; // could not print
+		}
+		va_start(args,fmt);
+		len=vsnprintf(buf->data+buf->length,len+1,fmt,args);
+		va_end(args);
+	}
+	buf->length+=len;
+
 	return len;
 }
 
 int carehttp_write(void * conn,const char *inbuf,int count) {
 	struct carehttp_connection *cur=conn;
-	struct carehttp_buf *buf=cur->outbufs+(cur->woutidx+1);
+	struct carehttp_buf *buf;
+	int rc;
 
-	if (cur->instate<0)
+	if (cur->instate!=1)
 		return -1;
 
-	// reserve space for the write
-	if (carehttp_buf_reserve(buf,buf->length+count+1)<0) {
+	if ((rc=carehttp_body_room(cur)))
+		return rc;
+	buf=cur->outbufs+(cur->woutidx+1);
+
+	// with a highwater only the part that fits is written
+	if (cur->highwater>0 && count>cur->highwater-buf->length)
+		count=cur->highwater-buf->length;
+
+	// copy in the data and increase the buf size
+	if (carehttp_buf_append(buf,inbuf,count)<0) {
 		cur->instate=-1;
 		return -1;
 	}
-	// copy in the data and increase the buf size
-	memcpy(buf->data+buf->length,inbuf,count);
-	buf->length+=count;
-	buf->data[buf->length]=0; // null terminate
 	return count;
 }
 
 void carehttp_finish(void *conn) {
 	struct carehttp_connection *cur=conn;
-	char tmp[40];
+	char tmp[16];
 
 	// this call will force the connection to be non-visible to a user so that it can be deallocated.
 	cur->visible=0;
+	cur->wantwrite=0;
+
+	// websockets are closed down with a close frame unless one has already been sent.
+	if (cur->instate==2) {
+		if (cur->websocket==1 && carehttp_ws_frame(cur,CAREHTTP_WS_CLOSE,"\x03\xe8",2)<0) // 1000 normal closure
+			cur->instate=-1;
+		cur->websocket=2;
+		cur->closing=1;
+		return;
+	}
 
 	// wrong state when calling this, ignore any effects.
 	if (cur->instate!=1)
 		return;
 
-	// setup the content length automatically
-	{
-		sprintf(tmp,"%d",cur->outbufs[cur->woutidx+1].length);
-		if (carehttp_set_header(conn,"Content-Length",tmp)<0) {
+	if (cur->streaming==2) {
+		// the end of a http/1.0 stream is told by closing the connection once the rest has been sent
+		cur->closing=1;
+	} else if (cur->streaming) {
+		// streamed responses end with the last chunk followed by an empty chunk
+		struct carehttp_buf *body=cur->outbufs+(cur->woutidx+1);
+		if (body->length && carehttp_frame_chunk(cur)<0) {
+			cur->instate=-1;
+			return;
+		}
+		if (carehttp_buf_append(body,"0\r\n\r\n",5)<0) {
+			cur->instate=-1;
+			return;
+		}
+	}
+	if (cur->streaming) {
+		// the poll function will queue it up once the previous chunk has been sent.
+		if (!carehttp_can_commit(cur)) {
+			cur->finishing=1;
+			return;
+		}
+		carehttp_commit_response(cur);
+		return;
+	}
+
+	// tell the client that the connection won't be kept alive
+	if (draining && carehttp_add_header(cur,"Connection",10,"close",5)<0) {
+		cur->instate=-1;
+		return;
+	}
+
+	// setup the content length automatically (1xx and 204 responses must not have one, nor a body)
+	if ((cur->headinfo.status>=100 && cur->headinfo.status<200) || cur->headinfo.status==204) {
+		cur->outbufs[cur->woutidx+1].length=0;
+	} else {
+		char *num=carehttp_utoa(tmp+sizeof(tmp),cur->outbufs[cur->woutidx+1].length);
+		if (carehttp_add_header(cur,"Content-Length",14,num,tmp+sizeof(tmp)-1-num)<0) {
 			cur->instate=-1;
 			return;
 		}
@@ -739,21 +1977,809 @@ void carehttp_finish(void *conn) {
 	// terminate headers with a newline
 	{
 		struct carehttp_buf *buf=cur->outbufs+cur->woutidx;
-		if (carehttp_buf_reserve(buf,buf->length+3)<0) {
+		if (carehttp_buf_append(buf,"\r\n",2)<0) {
 			cur->instate=-1; // flag error!
 			return;
 		}
-		strcpy(buf->data+buf->length,"\r\n");
-		buf->length+=2;
 	}
 
-	// swap the buffers
+	carehttp_commit_response(cur);
+}
+
+void carehttp_set_highwater(void *conn,int bytes) {
+	struct carehttp_connection *cur=conn;
+	if (cur)
+		cur->highwater=bytes;
+	else
+		default_highwater=bytes;
+}
+
+int carehttp_resumed(void *conn) {
+	struct carehttp_connection *cur=conn;
+	return cur->resumed;
+}
+
+// finds a request header (case insensitive) and returns its value or null if it wasn't found.
+static const char* carehttp_find_header(struct carehttp_connection *cur,const char *name) {
+	int nlen=strlen(name);
+	int pos=cur->headinfo.headers_index;
+	int end=cur->headinfo.headsize;
+	const char *rd=cur->inbuf.data;
+
+	while(pos<end) {
+		int i;
+		// skip over the null chars separating lines
+		if (!rd[pos]) {
+			pos++;
+			continue;
+		}
+		// compare the name
+		for (i=0;i<nlen && tolower((unsigned char)rd[pos+i])==tolower((unsigned char)name[i]);i++)
+			;
+		if (i==nlen && rd[pos+i]==':') {
+			pos+=i+1;
+			while(rd[pos]==' ' || rd[pos]=='\t')
+				pos++;
+			return rd+pos;
+		}
+		// otherwise go to the next line
+		pos+=strlen(rd+pos);
+	}
+	return 0;
+}
+
+// checks if a comma separated header value contains a token (case insensitive)
+static int carehttp_has_token(const char *value,const char *token) {
+	int tlen=strlen(token);
+	while(*value) {
+		int i;
+		while(*value==' ' || *value==',')
+			value++;
+		for (i=0;i<tlen && tolower((unsigned char)value[i])==tolower((unsigned char)token[i]);i++)
+			;
+		if (i==tlen && (!value[i] || value[i]==',' || value[i]==' '))
+			return 1;
+		while(*value && *value!=',')
+			value++;
+	}
+	return 0;
+}
+
+// a minimal sha1 implementation since it's needed for the websocket handshake
+#define SHA1ROL(v,n) ((((v)<<(n))|((v)>>(32-(n))))&0xffffffff)
+static void carehttp_sha1(const unsigned char *data,int len,unsigned char *out) {
+	unsigned long h[5]={0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476,0xC3D2E1F0};
+	unsigned long w[80];
+	int blocks=(len+9+63)/64;
+	int b,i;
+
+	for (b=0;b<blocks;b++) {
+		unsigned long a=h[0],bb=h[1],c=h[2],d=h[3],e=h[4];
+		// load the block with padding and the bit length at the end
+		for (i=0;i<64;i++) {
+			int idx=b*64+i;
+			unsigned long v;
+			if (idx<len)
+				v=data[idx];
+			else if (idx==len)
+				v=0x80;
+			else if (b==blocks-1 && i>=60)
+				v=((unsigned long)len*8>>((63-i)*8))&0xff;
+			else
+				v=0;
+			if (!(i&3))
+				w[i>>2]=0;
+			w[i>>2]|=v<<((3-(i&3))*8);
+		}
+		for (i=16;i<80;i++)
+			w[i]=SHA1ROL(w[i-3]^w[i-8]^w[i-14]^w[i-16],1);
+		for (i=0;i<80;i++) {
+			unsigned long f,k,t;
+			if (i<20) {
+				f=(bb&c)|((~bb)&d);
+				k=0x5A827999;
+			} else if (i<40) {
+				f=bb^c^d;
+				k=0x6ED9EBA1;
+			} else if (i<60) {
+				f=(bb&c)|(bb&d)|(c&d);
+				k=0x8F1BBCDC;
+			} else {
+				f=bb^c^d;
+				k=0xCA62C1D6;
+			}
+			t=(SHA1ROL(a,5)+(f&0xffffffff)+e+k+w[i])&0xffffffff;
+			e=d;
+			d=c;
+			c=SHA1ROL(bb,30);
+			bb=a;
+			a=t;
+		}
+		h[0]=(h[0]+a)&0xffffffff;
+		h[1]=(h[1]+bb)&0xffffffff;
+		h[2]=(h[2]+c)&0xffffffff;
+		h[3]=(h[3]+d)&0xffffffff;
+		h[4]=(h[4]+e)&0xffffffff;
+	}
+	for (i=0;i<20;i++)
+		out[i]=(h[i>>2]>>((3-(i&3))*8))&0xff;
+}
+#undef SHA1ROL
+
+// base64 encodes data into out (that needs to have space for 4*((len+2)/3)+1 chars)
+static void carehttp_base64(const unsigned char *data,int len,char *out) {
+	static const char digits[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	int i;
+	for (i=0;i<len;i+=3) {
+		unsigned long v=(unsigned long)data[i]<<16;
+		if (i+1<len)
+			v|=data[i+1]<<8;
+		if (i+2<len)
+			v|=data[i+2];
+		*out++=digits[(v>>18)&63];
+		*out++=digits[(v>>12)&63];
+		*out++=i+1<len?digits[(v>>6)&63]:'=';
+		*out++=i+2<len?digits[v&63]:'=';
+	}
+	*out=0;
+}
+
+int carehttp_ws_upgrade(void *conn) {
+	struct carehttp_connection *cur=conn;
+	const char *upgrade=carehttp_find_header(cur,"Upgrade");
+	const char *connection=carehttp_find_header(cur,"Connection");
+	const char *key=carehttp_find_header(cur,"Sec-WebSocket-Key");
+	const char *version=carehttp_find_header(cur,"Sec-WebSocket-Version");
+	char accept[100];
+	unsigned char digest[20];
+	int keylen;
+
+	if (cur->instate!=1 || cur->streaming || cur->outbufs[cur->woutidx].length || cur->outbufs[cur->woutidx+1].length)
+		return -1; // not a fresh request
+	if (strncmp(cur->inbuf.data,"GET ",4) || !upgrade || !carehttp_has_token(upgrade,"websocket")
+		|| !connection || !carehttp_has_token(connection,"Upgrade") || !key || (keylen=strlen(key))>60)
+		return -1; // not a websocket request
+	if (!version || !carehttp_has_token(version,"13"))
+		return CAREHTTP_WS_BADVERSION; // the caller should answer with 426 and the version we support
+
+	// the accept value is the hashed key together with a fixed guid
+	memcpy(accept,key,keylen);
+	memcpy(accept+keylen,"258EAFA5-E914-47DA-95CA-C5AB0DC85B11",36);
+	carehttp_sha1((unsigned char*)accept,keylen+36,digest);
+	carehttp_base64(digest,20,accept);
+
+	if (carehttp_responsecode(cur,101)<0
+		|| carehttp_add_header(cur,"Upgrade",7,"websocket",9)<0
+		|| carehttp_add_header(cur,"Connection",10,"Upgrade",7)<0
+		|| carehttp_add_header(cur,"Sec-WebSocket-Accept",20,accept,strlen(accept))<0
+		|| carehttp_buf_append(cur->outbufs+cur->woutidx,"\r\n",2)<0) {
+		cur->instate=-1;
+		return -1;
+	}
+
+	// queue up the handshake and switch over to websocket processing,
+	// anything following the headers is already frame data.
+	carehttp_commit_response(cur);
+	cur->instate=2;
+	cur->websocket=1;
+	return 0;
+}
+
+// appends a frame to the output, server frames are never masked
+static int carehttp_ws_frame(struct carehttp_connection *cur,int opcode,const char *data,int count) {
+	struct carehttp_buf *buf=cur->outbufs+(cur->woutidx+1);
+	char hdr[10];
+	int hl=2;
+
+	hdr[0]=0x80|(opcode&15); // always send unfragmented frames
+	if (count<126) {
+		hdr[1]=count;
+	} else if (count<65536) {
+		hdr[1]=126;
+		hdr[2]=count>>8;
+		hdr[3]=count;
+		hl=4;
+	} else {
+		hdr[1]=127;
+		hdr[2]=hdr[3]=hdr[4]=hdr[5]=0;
+		hdr[6]=count>>24;
+		hdr[7]=count>>16;
+		hdr[8]=count>>8;
+		hdr[9]=count;
+		hl=10;
+	}
+	if (carehttp_buf_reserve(buf,buf->length+hl+count+1))
+		return -1;
+	memcpy(buf->data+buf->length,hdr,hl);
+	memcpy(buf->data+buf->length+hl,data,count);
+	buf->length+=hl+count;
+	buf->data[buf->length]=0;
+	return 0;
+}
+
+// decodes frames in the input buffer until a message is complete (or more data is needed),
+// control frames are answered directly. returns -1 on protocol errors.
+static int carehttp_ws_parse(struct carehttp_connection *cur) {
+	unsigned char *rd=(unsigned char*)cur->inbuf.data;
+	int pos=0;
+
+	while(!cur->wsready) {
+		int avail=cur->inbuf.length-pos;
+		int fin,op,hl=2,i;
+		unsigned long len;
+		unsigned char *mask,*payload;
+
+		if (avail<2)
+			break;
+		// frames are left for later while answers to pings and such can't be sent
+		if (carehttp_output_full(cur))
+			break;
+		fin=rd[pos]&0x80;
+		op=rd[pos]&15;
+		if (!(rd[pos+1]&0x80) || (rd[pos]&0x70))
+			return -1; // clients MUST mask frames and we don't support extensions
+		len=rd[pos+1]&127;
+		if (len==126) {
+			if (avail<4)
+				break;
+			len=(rd[pos+2]<<8)|rd[pos+3];
+			hl=4;
+		} else if (len==127) {
+			if (avail<10)
+				break;
+			if (rd[pos+2] || rd[pos+3] || rd[pos+4] || rd[pos+5] || rd[pos+6]&0x80)
+				return -1; // way too large
+			len=((unsigned long)rd[pos+6]<<24)|(rd[pos+7]<<16)|(rd[pos+8]<<8)|rd[pos+9];
+			hl=10;
+		}
+		if (len>CAREHTTP_WS_MAXMESSAGE || cur->wsmsg.length+len>CAREHTTP_WS_MAXMESSAGE)
+			return -1;
+		if (avail<hl+4+(int)len)
+			break; // wait for the rest of the frame
+		mask=rd+pos+hl;
+		payload=mask+4;
+		for (i=0;i<(int)len;i++)
+			payload[i]^=mask[i&3];
+		pos+=hl+4+len;
+
+		if (op&8) {
+			// control frames can appear between the fragments of messages
+			if (!fin || len>125)
+				return -1;
+			if (op==CAREHTTP_WS_PING) {
+				if (carehttp_ws_frame(cur,CAREHTTP_WS_PONG,(char*)payload,len)<0)
+					return -1;
+			} else if (op==CAREHTTP_WS_CLOSE) {
+				// echo the close status back and report the close to the user
+				if (carehttp_ws_frame(cur,CAREHTTP_WS_CLOSE,(char*)payload,len<2?len:2)<0)
+					return -1;
+				cur->wsmsg.length=0;
+				if (carehttp_buf_append(&cur->wsmsg,(char*)payload,len)<0)
+					return -1;
+				cur->wsready=CAREHTTP_WS_CLOSE;
+				cur->websocket=2;
+				cur->closing=1;
+			} else if (op!=CAREHTTP_WS_PONG) {
+				return -1;
+			}
+			continue;
+		}
+
+		// data frames, either the first part of a message or a continuation
+		if (op) {
+			if (cur->wsop || (op!=CAREHTTP_WS_TEXT && op!=CAREHTTP_WS_BINARY))
+				return -1;
+			cur->wsop=op;
+		} else if (!cur->wsop) {
+			return -1;
+		}
+		if (carehttp_buf_append(&cur->wsmsg,(char*)payload,len)<0)
+			return -1;
+		if (fin) {
+			cur->wsready=cur->wsop;
+			cur->wsop=0;
+		}
+	}
+
+	// drop the consumed frames
+	memmove(cur->inbuf.data,cur->inbuf.data+pos,cur->inbuf.length-pos);
+	cur->inbuf.length-=pos;
+	return 0;
+}
+
+const char* carehttp_ws_message(void *conn,int *opcode,int *length) {
+	struct carehttp_connection *cur=conn;
+
+	if (!cur->wsready)
+		return 0;
+	if (opcode)
+		*opcode=cur->wsready;
+	if (length)
+		*length=cur->wsmsg.length;
+	return cur->wsmsg.data?cur->wsmsg.data:"";
+}
+
+int carehttp_ws_send(void *conn,int opcode,const char *data,int count) {
+	struct carehttp_connection *cur=conn;
+	int rc;
+
+	if (cur->instate!=2 || cur->websocket!=1 || count<0)
+		return -1;
+
+	if ((rc=carehttp_body_room(cur)))
+		return rc;
+
+	if (carehttp_ws_frame(cur,opcode,data,count)<0) {
+		cur->instate=-1;
+		return -1;
+	}
+	return count;
+}
+
+int carehttp_sse_subscribe(void *conn,const char *name) {
+	struct carehttp_connection *cur=conn;
+	struct carehttp_channel *ch;
+
+	// the connection is handed over to the library regardless of the outcome
+	cur->visible=0;
+	cur->wantwrite=0;
+
+	if (cur->instate!=1 || cur->streaming)
+		return -1;
+
+	// the stream is a response without a length, anything printed before subscribing begins the stream.
+	if (!(cur->evqueue=(struct carehttp_event**)malloc(sizeof(struct carehttp_event*)*(sse_maxqueued>0?sse_maxqueued:1)))
+		|| carehttp_add_header(cur,"Content-Type",12,"text/event-stream",17)<0
+		|| carehttp_add_header(cur,"Cache-Control",13,"no-cache",8)<0
+		|| carehttp_add_header(cur,"Connection",10,"close",5)<0
+		|| carehttp_buf_append(cur->outbufs+cur->woutidx,"\r\n",2)<0) {
+		cur->instate=-1;
+		return -1;
+	}
+	cur->evcap=sse_maxqueued>0?sse_maxqueued:1;
+	cur->evfirst=0;
+	cur->evcount=0;
+	cur->evoffset=0;
 	cur->woutidx=(cur->woutidx+2)%OUTBUFS;
 
-	// on the request side dump the request header data to process the next request on this socket.
-	memmove(cur->inbuf.data,cur->inbuf.data+cur->headinfo.headsize,cur->inbuf.length-cur->headinfo.headsize);
-	cur->inbuf.length-=cur->headinfo.headsize;
-	cur->instate=0; // reset the parsing state once we've finished
-	memset(&cur->headinfo,0,sizeof(cur->headinfo));
+	// find or create the channel (after everything else that can fail so an empty channel is never left behind)
+	for (ch=channels;ch && strcmp(ch->name,name);ch=ch->next)
+		;
+	if (!ch) {
+		if (!(ch=(struct carehttp_channel*)malloc(sizeof(struct carehttp_channel))) || !(ch->name=(char*)malloc(strlen(name)+1))) {
+			free(ch);
+			cur->instate=-1;
+			return -1;
+		}
+		strcpy(ch->name,name);
+		ch->subscribers=0;
+		ch->next=channels;
+		channels=ch;
+	}
+
+	cur->instate=3;
+	cur->channel=ch;
+	cur->chnext=ch->subscribers;
+	ch->subscribers=cur;
+	return 0;
+}
+
+int carehttp_sse_publish(const char *name,const char *event,const char *data) {
+	struct carehttp_channel *ch;
+	struct carehttp_connection *cur;
+	struct carehttp_event *ev;
+	const char *rd;
+	char *wp;
+	int len=1,lines=1;
+
+	// a line break in the event name would let it inject other fields
+	if (event && strpbrk(event,"\r\n"))
+		return -1;
+
+	for (ch=channels;ch && strcmp(ch->name,name);ch=ch->next)
+		;
+	if (!ch)
+		return 0; // nobody has subscribed to this channel
+
+	// calculate the encoded size, every line of data becomes a data field.
+	// lines can end with crlf, cr or lf just like in the event stream itself.
+	if (event)
+		len+=8+strlen(event);
+	for (rd=data;*rd;rd++)
+		lines+=*rd=='\r' || (*rd=='\n' && (rd==data || rd[-1]!='\r'));
+	len+=(rd-data)+lines*7;
+
+	if (!(ev=(struct carehttp_event*)malloc(sizeof(struct carehttp_event)+len)))
+		return -1;
+	ev->refs=1; // held while publishing
+	wp=ev->data;
+	if (event) {
+		memcpy(wp,"event: ",7);
+		wp+=7;
+		wp+=strlen(strcpy(wp,event));
+		*wp++='\n';
+	}
+	rd=data;
+	while(1) {
+		const char *eol=strpbrk(rd,"\r\n");
+		int ll=eol?(int)(eol-rd):(int)strlen(rd);
+		memcpy(wp,"data: ",6);
+		memcpy(wp+6,rd,ll);
+		wp+=6+ll;
+		*wp++='\n';
+		if (!eol)
+			break;
+		rd=eol+(eol[0]=='\r' && eol[1]=='\n'?2:1);
+	}
+	*wp++='\n';
+	ev->length=wp-ev->data;
+
+	// queue up a reference to the event for every subscriber (disconnected ones stay listed until cleaned up)
+	len=0;
+	for (cur=ch->subscribers;cur;cur=cur->chnext) {
+		if (cur->instate!=3)
+			continue;
+		if (cur->evcount==cur->evcap) {
+			// a slow subscriber, either drop it or its oldest event (that isn't being sent)
+			if (sse_policy==CAREHTTP_SSE_DISCONNECT) {
+				cur->instate=-1;
+				continue;
+			} else if (carehttp_event_busy(cur)>=cur->evcount) {
+				continue; // only events being sent are queued so this one is skipped
+			} else {
+				// keep events that are being sent since they can't be taken back
+				int i=(cur->evfirst+carehttp_event_busy(cur))%cur->evcap;
+				carehttp_event_release(cur->evqueue[i]);
+				// move the events before it one step ahead
+				while(i!=cur->evfirst) {
+					int prev=(i+cur->evcap-1)%cur->evcap;
+					cur->evqueue[i]=cur->evqueue[prev];
+					i=prev;
+				}
+				cur->evfirst=(cur->evfirst+1)%cur->evcap;
+				cur->evcount--;
+			}
+		}
+		cur->evqueue[(cur->evfirst+cur->evcount)%cur->evcap]=ev;
+		cur->evcount++;
+		ev->refs++;
+		len++;
+	}
+	carehttp_event_release(ev);
+
+	return len;
+}
+
+void carehttp_sse_set_policy(int maxqueued,int policy) {
+	sse_maxqueued=maxqueued;
+	sse_policy=policy;
 }
 
+void* carehttp_adopt_listener(int fd) {
+	struct carehttp_connection *cur;
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in;
+#ifndef WIN32
+		struct sockaddr_in6 in6;
+		struct sockaddr_un un;
+#endif
+	} addr;
+#ifdef WIN32
+	int addrsize=sizeof(addr);
+#else
+	socklen_t addrsize=sizeof(addr);
+#endif
+
+	// find out what the socket is listening to
+	memset(&addr,0,sizeof(addr));
+	if (getsockname(fd,&addr.sa,&addrsize))
+		return 0;
+	if (addr.sa.sa_family==AF_INET) {
+		cur=carehttp_find_listener(ntohs(addr.in.sin_port),0);
+		if (!cur)
+			return carehttp_new_listener(ntohs(addr.in.sin_port),0,fd);
+#ifndef WIN32
+	} else if (addr.sa.sa_family==AF_INET6) {
+		cur=carehttp_find_listener(ntohs(addr.in6.sin6_port),0);
+		if (!cur)
+			return carehttp_new_listener(ntohs(addr.in6.sin6_port),0,fd);
+	} else if (addr.sa.sa_family==AF_UNIX) {
+		char path[sizeof(addr.un.sun_path)+1];
+		int len=addrsize-offsetof(struct sockaddr_un,sun_path);
+		if (len<=1)
+			return 0; // unnamed socket
+		if (addr.un.sun_path[0]) {
+			// a filesystem path, it might be null terminated
+			memcpy(path,addr.un.sun_path,len);
+			path[len]=0;
+		} else {
+			// abstract names are written with a leading @
+			memcpy(path,addr.un.sun_path,len);
+			path[0]='@';
+			path[len]=0;
+		}
+		cur=carehttp_find_listener(0,path);
+		if (!cur)
+			return carehttp_new_listener(0,path,fd);
+#endif
+	} else {
+		return 0;
+	}
+
+	// there is a record for this listener already, take over the socket if the record has none.
+	if (cur->handle!=-1)
+		return 0;
+	cur->handle=fd;
+	carehttp_socket_set_nonblocking(fd);
+	return cur;
+}
+
+// the handoff message carries the number of sockets with the listening sockets attached
+// (the receiver finds out what they listen to by itself)
+#define HANDOFF_MAX 64
+
+int carehttp_send_listeners(int unixsock) {
+#ifdef WIN32
+	return -1; // no fd passing on windows
+#else
+	struct carehttp_connection *cur;
+	int fds[HANDOFF_MAX];
+	int count=0;
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(fds))];
+	} ctl;
+
+	for (cur=connections;cur && count<HANDOFF_MAX;cur=cur->next) {
+		if (cur->parent || cur->handle==-1)
+			continue;
+		fds[count++]=cur->handle;
+	}
+	if (!count)
+		return 0;
+
+	memset(&msg,0,sizeof(msg));
+	memset(&ctl,0,sizeof(ctl));
+	iov.iov_base=&count;
+	iov.iov_len=sizeof(count);
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=ctl.buf;
+	msg.msg_controllen=CMSG_SPACE(count*sizeof(int));
+	CMSG_FIRSTHDR(&msg)->cmsg_level=SOL_SOCKET;
+	CMSG_FIRSTHDR(&msg)->cmsg_type=SCM_RIGHTS;
+	CMSG_FIRSTHDR(&msg)->cmsg_len=CMSG_LEN(count*sizeof(int));
+	memcpy(CMSG_DATA(CMSG_FIRSTHDR(&msg)),fds,count*sizeof(int));
+
+	if (sendmsg(unixsock,&msg,0)<0)
+		return -1;
+	return count;
+#endif
+}
+
+int carehttp_recv_listeners(int unixsock) {
+#ifdef WIN32
+	return -1; // no fd passing on windows
+#else
+	int fds[HANDOFF_MAX];
+	int count,nfds,i,adopted=0;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(fds))];
+	} ctl;
+
+	memset(&msg,0,sizeof(msg));
+	iov.iov_base=&count;
+	iov.iov_len=sizeof(count);
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=ctl.buf;
+	msg.msg_controllen=sizeof(ctl.buf);
+
+	if (0>=(i=recvmsg(unixsock,&msg,0)))
+		return i<0?-1:0;
+	if (!(cm=CMSG_FIRSTHDR(&msg)) || cm->cmsg_level!=SOL_SOCKET || cm->cmsg_type!=SCM_RIGHTS)
+		return -1;
+	nfds=(cm->cmsg_len-CMSG_LEN(0))/sizeof(int);
+	memcpy(fds,CMSG_DATA(cm),nfds*sizeof(int));
+
+	for (i=0;i<nfds;i++) {
+		// sockets we can't use are closed so they don't leak
+		if (!carehttp_adopt_listener(fds[i]))
+			closesocket(fds[i]);
+		else
+			adopted++;
+	}
+	return adopted;
+#endif
+}
+
+void carehttp_drain(void) {
+	struct carehttp_connection *cur;
+
+	draining=1;
+	drainstart=time(0);
+	// stop accepting, the listener records are kept so that polling the ports won't reopen them.
+	for (cur=connections;cur;cur=cur->next) {
+		if (cur->parent || cur->handle==-1)
+			continue;
+#ifdef CAREHTTP_URING
+		// the accept is held by io_uring even after the socket is closed so it must be cancelled
+		if (uring.active && cur->uring_recv==1)
+			carehttp_uring_cancel(cur);
+#endif
+		closesocket(cur->handle);
+		cur->handle=-1;
+	}
+}
+
+int carehttp_drained(void) {
+	struct carehttp_connection *cur;
+
+	if (!draining)
+		return 0;
+	for (cur=connections;cur;cur=cur->next) {
+		if (cur->parent)
+			return 0;
+	}
+	return 1;
+}
+
+void* carehttp_listen_transport(const struct carehttp_transport *transport,void *ctx) {
+	struct carehttp_connection **pcon=&connections;
+	struct carehttp_connection *nc;
+	if (!transport || !(nc=(struct carehttp_connection*)calloc(1,sizeof(struct carehttp_connection))))
+		return 0;
+	nc->handle=-1;
+	nc->transport=transport;
+	nc->ctx=ctx;
+
+	carehttp_startup();
+
+	while(*pcon)
+		pcon=&(*pcon)->next;
+	*pcon=nc;
+	return nc;
+}
+
+// the in-memory transport keeps the bytes of both directions in buffers, the client end feeds requests in and collects the responses.
+// an endpoint is free'd once both ends have closed it.
+struct carehttp_memconn {
+	struct carehttp_memconn *next; // next endpoint waiting to be accepted
+	struct carehttp_buf in,out;
+	int inoffset,outoffset;        // how much of the buffers that has been consumed
+	int chunk;                     // max number of bytes handed to the parser per read (0 for no limit)
+	int clientclosed,serverclosed;
+};
+
+struct carehttp_memlistener {
+	struct carehttp_memconn *pending,**tail;
+	int chunk;
+};
+
+static int carehttp_memory_accept(void *ctx,void **connctx) {
+	struct carehttp_memlistener *ml=(struct carehttp_memlistener*)ctx;
+	struct carehttp_memconn *mc=ml->pending;
+	if (!mc)
+		return 0;
+	if (!(ml->pending=mc->next))
+		ml->tail=&ml->pending;
+	mc->next=0;
+	*connctx=mc;
+	return 1;
+}
+
+static int carehttp_memory_recv(void *ctx,char *buf,int size) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)ctx;
+	int count=mc->in.length-mc->inoffset;
+	if (!count)
+		return mc->clientclosed?0:CAREHTTP_WOULDBLOCK;
+	if (mc->chunk && count>mc->chunk)
+		count=mc->chunk;
+	if (count>size)
+		count=size;
+	memcpy(buf,mc->in.data+mc->inoffset,count);
+	// start over from the beginning of the buffer once everything fed has been read
+	if ((mc->inoffset+=count)==mc->in.length)
+		mc->inoffset=mc->in.length=0;
+	return count;
+}
+
+static int carehttp_memory_send(void *ctx,const char *buf,int size) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)ctx;
+	if (mc->clientclosed)
+		return -1; // nobody is listening anymore
+	if (carehttp_buf_append(&mc->out,buf,size))
+		return -1;
+	return size;
+}
+
+static void carehttp_memory_free(struct carehttp_memconn *mc) {
+	if (mc->in.data)
+		free(mc->in.data);
+	if (mc->out.data)
+		free(mc->out.data);
+	free(mc);
+}
+
+static void carehttp_memory_serverclose(void *ctx) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)ctx;
+	mc->serverclosed=1;
+	if (mc->clientclosed)
+		carehttp_memory_free(mc);
+}
+
+static const struct carehttp_transport carehttp_memory_transport={
+	carehttp_memory_accept,
+	carehttp_memory_recv,
+	carehttp_memory_send,
+	carehttp_memory_serverclose
+};
+
+void* carehttp_listen_memory(int chunk) {
+	struct carehttp_memlistener *ml=(struct carehttp_memlistener*)calloc(1,sizeof(struct carehttp_memlistener));
+	void *out;
+	if (!ml)
+		return 0;
+	ml->tail=&ml->pending;
+	ml->chunk=chunk>0?chunk:0;
+	if (!(out=carehttp_listen_transport(&carehttp_memory_transport,ml)))
+		free(ml);
+	return out;
+}
+
+void* carehttp_memory_connect(void *listener) {
+	struct carehttp_connection *cur=(struct carehttp_connection*)listener;
+	struct carehttp_memlistener *ml;
+	struct carehttp_memconn *mc;
+	if (!cur || cur->parent || cur->transport!=&carehttp_memory_transport || draining)
+		return 0;
+	ml=(struct carehttp_memlistener*)cur->ctx;
+	if (!(mc=(struct carehttp_memconn*)calloc(1,sizeof(struct carehttp_memconn))))
+		return 0;
+	mc->chunk=ml->chunk;
+	// queue it up to be accepted by the next poll
+	*ml->tail=mc;
+	ml->tail=&mc->next;
+	return mc;
+}
+
+int carehttp_memory_feed(void *client,const char *data,int count) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)client;
+	if (mc->clientclosed || mc->serverclosed || count<0)
+		return -1;
+	if (carehttp_buf_append(&mc->in,data,count))
+		return -1;
+	return count;
+}
+
+int carehttp_memory_collect(void *client,char *out,int size) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)client;
+	int count=mc->out.length-mc->outoffset;
+	if (!count)
+		return mc->serverclosed?-1:0;
+	if (count>size)
+		count=size;
+	memcpy(out,mc->out.data+mc->outoffset,count);
+	if ((mc->outoffset+=count)==mc->out.length)
+		mc->outoffset=mc->out.length=0;
+	return count;
+}
+
+int carehttp_memory_unread(void *client) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)client;
+	return mc->in.length-mc->inoffset;
+}
+
+void carehttp_memory_close(void *client) {
+	struct carehttp_memconn *mc=(struct carehttp_memconn*)client;
+	mc->clientclosed=1;
+	if (mc->serverclosed)
+		carehttp_memory_free(mc);
+}
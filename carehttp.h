@@ -7,6 +7,17 @@
 // the connection will NOT be free'd until a carehttp_finish call has been made.
 void* carehttp_poll(int port);
 
+// opens a listener on a tcp port (the same one that carehttp_poll opens for a port) and returns a handle to it.
+// a null return indicates that the port couldn't be opened (or that it's a new port while draining).
+void* carehttp_listen(int port);
+
+// opens a listener on a unix domain socket path, paths beginning with @ are opened in the abstract namespace (linux only).
+// a null return indicates that the socket couldn't be opened (or that it's a new path while draining).
+void* carehttp_listen_unix(const char *path);
+
+// works like carehttp_poll but returns connections made to the listener handle.
+void* carehttp_poll_listener(void *listener);
+
 // carehttp_match is used to match request adresses to determine what to respond to.
 // it functions similarly to scanf but returns true only when a full match is made
 //
@@ -22,26 +33,150 @@ int carehttp_match(void *conn,const char *fmt,...);
 // otherwise the string size is returned
 int carehttp_get_param(void *conn,char *out,int outsize,const char *param_name);
 
-// sets the response code to send back to the client.
+// sets the response code to send back to the client (a Date header is added along with it).
 // can only be called once per request and MUST be sent before any headers.
 // a negative response indicates that an error has occured
 int carehttp_responsecode(void *conn,int code);
 
-// sets a response header, this will implicitly add an 200/OK response code
+// sets a response header, headers can be added after any response code has been set
+// but if none was set this will implicitly add an 200/OK response code
 // so trying to report an error after a header has been set with this is not possible.
 // a negative return value indicates that an error has occured
 int carehttp_set_header(void *conn,const char *head,const char *data);
 
+// returned by the output functions on connections with a highwater set when
+// too much data is waiting to be sent, nothing has been written in that case.
+#define CAREHTTP_WOULDBLOCK (-2)
+
+// returned by carehttp_ws_upgrade for websocket requests of an unsupported version.
+#define CAREHTTP_WS_BADVERSION (-3)
+
 // prints characters to an output
-// a negative return indicates that an error has occured
+// a negative return indicates that an error has occured (or CAREHTTP_WOULDBLOCK)
 // otherwise return the number of characters printed
 int carehttp_printf(void *conn,const char *fmt,...);
 
 // writes a number of binary bytes
-// either return the number of characters written or an negtive number on error
+// either return the number of characters written or an negtive number on error (or CAREHTTP_WOULDBLOCK)
+// with a highwater set only the part that fits below the highwater is written.
 int carehttp_write(void *conn,const char *inbuf,int count);
 
-// finalizes 
+// sets the max number of bytes to buffer up for a connection before writes return CAREHTTP_WOULDBLOCK,
+// passing a null connection sets the value used for new connections.
+// with a highwater the body is sent out with chunked encoding as it's produced instead of at finish,
+// a value of 0 (the default) buffers the entire body until finish is called.
+// once a write has been refused the connection is returned by carehttp_poll again when writing can be resumed.
+void carehttp_set_highwater(void *conn,int bytes);
+
+// returns non-zero if the connection was returned by carehttp_poll to resume writing
+// rather than for a new request (writes will return an error if the connection has failed)
+int carehttp_resumed(void *conn);
+
+// finalizes the request (or closes an upgraded websocket), the handle must not be used afterwards.
 void carehttp_finish(void *conn);
 
+// websocket opcodes
+#define CAREHTTP_WS_TEXT   1
+#define CAREHTTP_WS_BINARY 2
+#define CAREHTTP_WS_CLOSE  8
+#define CAREHTTP_WS_PING   9
+#define CAREHTTP_WS_PONG   10
+
+// messages larger than this will close the websocket
+#define CAREHTTP_WS_MAXMESSAGE (1<<24)
+
+// upgrades a matched request with an "Upgrade: websocket" header to a websocket.
+// the handle stays valid after this and is returned again by carehttp_poll whenever a message
+// has been received (or for writable notifications), it remains valid until carehttp_finish is called.
+// a negative return indicates that the request wasn't a websocket request or an error occured,
+// CAREHTTP_WS_BADVERSION is returned for websocket requests of another version than 13 (answer those with
+// a 426 response and a "Sec-WebSocket-Version: 13" header).
+int carehttp_ws_upgrade(void *conn);
+
+// returns the message that caused carehttp_poll to return a websocket or null if there was no message.
+// the message is valid until the next carehttp_poll call, text and binary messages are reported with
+// their opcode while a closed connection is reported with CAREHTTP_WS_CLOSE (call carehttp_finish then).
+// pings are answered automatically and never reported.
+const char* carehttp_ws_message(void *conn,int *opcode,int *length);
+
+// sends a message on a websocket, the data is sent out from carehttp_poll.
+// either returns the count or a negative number on error (or CAREHTTP_WOULDBLOCK with a highwater set)
+int carehttp_ws_send(void *conn,int opcode,const char *data,int count);
+
+// policies for event stream subscribers that have too many events queued up
+#define CAREHTTP_SSE_DISCONNECT  0 // close the connection to the subscriber
+#define CAREHTTP_SSE_DROP_OLDEST 1 // skip the oldest queued event that hasn't begun sending
+
+// turns a request into a text/event-stream response that subscribes to the named channel.
+// anything already printed will be sent at the start of the stream.
+// the library takes over the connection so the handle must not be used afterwards (just like carehttp_finish)
+// a negative return value indicates that an error has occured
+int carehttp_sse_subscribe(void *conn,const char *channel);
+
+// publishes an event to all subscribers of a channel, event names the event and can be null (it must not contain line breaks).
+// the event is encoded once and shared by all subscribers, multiline data (crlf, cr or lf separated) is sent as multiple data fields.
+// only the subscribers of the channel are visited, channels without subscribers are freed and publishing to them does nothing.
+// returns the number of subscribers the event was queued for or a negative number on error.
+int carehttp_sse_publish(const char *channel,const char *event,const char *data);
+
+// sets how many events can be queued up per subscriber (for subscriptions made afterwards)
+// and what to do when a subscriber has that many events queued, the default is 64 with CAREHTTP_SSE_DISCONNECT.
+void carehttp_sse_set_policy(int maxqueued,int policy);
+
+// adopts an already listening tcp or unix domain socket (for example one inherited from a parent process)
+// and returns a listener handle for it, carehttp_poll and carehttp_listen will use it for that port or path.
+// a null return indicates that an error has occured (or that the port or path already has a listener)
+void* carehttp_adopt_listener(int fd);
+
+// sends all listening sockets over a connected unix domain socket to another process (not available on windows),
+// this allows a new process to take over the ports without closing them so no connections are refused.
+// returns the number of sent sockets or a negative number on error.
+int carehttp_send_listeners(int unixsock);
+
+// receives listening sockets sent by carehttp_send_listeners and adopts them.
+// returns the number of adopted sockets or a negative number on error.
+int carehttp_recv_listeners(int unixsock);
+
+// stops accepting new connections, requests in progress are finished and then their connections are closed
+// (websockets get a close message and event streams are closed once their queued events are sent).
+// keep calling carehttp_poll until carehttp_drained returns non-zero.
+void carehttp_drain(void);
+
+// returns non-zero once draining has finished and all connections have been closed.
+int carehttp_drained(void);
+
+// a transport moves the data of connections for a listener instead of sockets, the ctx values are passed back to the functions.
+// recv and send return the number of bytes moved, CAREHTTP_WOULDBLOCK when nothing could be moved right now or -1 on errors
+// (recv returns 0 when the other end has closed). accept returns 1 and sets the connection ctx when a new connection is available.
+// polling a transport listener never sleeps since the transport is expected to be driven by the application.
+struct carehttp_transport {
+	int (*accept)(void *listenctx,void **connctx);
+	int (*recv)(void *connctx,char *buf,int size);
+	int (*send)(void *connctx,const char *buf,int size);
+	void (*close)(void *connctx);
+};
+
+// creates a listener using a transport, poll it with carehttp_poll_listener.
+void* carehttp_listen_transport(const struct carehttp_transport *transport,void *ctx);
+
+// creates a listener with the built in memory transport (useful for testing and benchmarking without sockets),
+// chunk limits how many bytes the parser gets to see on each poll (0 for no limit) so that reads are split up deterministically.
+void* carehttp_listen_memory(int chunk);
+
+// connects a client endpoint to a memory listener, the connection is accepted by the next poll of the listener.
+void* carehttp_memory_connect(void *listener);
+
+// feeds request data to the server side of a memory connection, returns count or -1 if the connection has been closed.
+int carehttp_memory_feed(void *client,const char *data,int count);
+
+// collects up to size bytes of response data, returns the number of bytes collected or -1 once the server
+// has closed the connection and everything has been collected.
+int carehttp_memory_collect(void *client,char *out,int size);
+
+// returns the number of fed bytes that the server hasn't read yet.
+int carehttp_memory_unread(void *client);
+
+// closes the client end of a memory connection, the endpoint handle is invalid after this.
+void carehttp_memory_close(void *client);
+
 #endif // __INCLUDED_CAREHTTP_H__